@@ -0,0 +1,55 @@
+import argparse
+import itertools
+import os
+import time
+import pyarrow.parquet as pq
+
+CODECS = ["none", "snappy", "lz4", "zstd"]
+ENCODINGS = ["plain", "dictionary", "split"]
+
+def write(table, path, row_group, codec, encoding, statistics):
+    '''
+        Writes table with the same writer settings the executable uses for
+        --row-group, --compression, --encoding and --no-statistics.
+    '''
+    floats = [field.name for field in table.schema if str(field.type) == "double"]
+    pq.write_table(table, path,
+        row_group_size=row_group,
+        compression=codec,
+        use_dictionary=True if encoding == "dictionary" else [field.name for field in table.schema if field.name not in floats],
+        use_byte_stream_split=floats if encoding == "split" else False,
+        write_statistics=statistics)
+
+def bench_output(DATA_OUT_FILE, ROW_GROUPS, REPEAT):
+    '''
+        Rewrites a tracking output with every combination of row-group size, codec, float encoding
+        and statistics, and reports file size and best-of-REPEAT write and read times.
+    '''
+    table = pq.read_table(DATA_OUT_FILE)
+    tmp_file = os.path.splitext(DATA_OUT_FILE)[0] + "_bench.parquet"
+
+    print("%d rows, %d columns" % (table.num_rows, table.num_columns))
+    print("row group\tcodec\tencoding\tstatistics\tsize (KiB)\twrite (ms)\tread (ms)")
+    for row_group, codec, encoding, statistics in itertools.product(ROW_GROUPS, CODECS, ENCODINGS, [True, False]):
+        writeTimes = []
+        readTimes = []
+        for _ in range(REPEAT):
+            start = time.perf_counter()
+            write(table, tmp_file, row_group, codec, encoding, statistics)
+            writeTimes.append(time.perf_counter() - start)
+
+            start = time.perf_counter()
+            pq.read_table(tmp_file)
+            readTimes.append(time.perf_counter() - start)
+        size = os.path.getsize(tmp_file) / 1024
+        print("%d\t\t%s\t%s\t%s\t\t%.1f\t\t%.2f\t\t%.2f" % (row_group, codec, encoding.ljust(10), statistics, size, min(writeTimes) * 1e3, min(readTimes) * 1e3))
+    os.remove(tmp_file)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="benchmark parquet writer settings on a tracking output")
+    parser.add_argument("FILEPATH", help="path to parquet file")
+    parser.add_argument("-g", "--row-groups", default="3 4096 65536", help="row-group sizes to try (Default: '3 4096 65536')")
+    parser.add_argument("-r", "--repeat", type=int, default=3, help="runs per combination, best is reported (Default: 3)")
+
+    args = parser.parse_args()
+    bench_output(args.FILEPATH, [int(rows) for rows in args.row_groups.split()], args.repeat)
@@ -0,0 +1,66 @@
+import argparse
+import os
+import re
+import subprocess
+import numpy as np
+import pandas as pd
+
+PROFILES = ["accurate", "balanced", "fast"]
+
+def run_profile(EXECUTABLE, FILEPATH, ARGS, tracker, profile):
+    '''
+        Runs the given tracker (with the given CSRT profile) and returns (elapsed seconds, path of its parquet output).
+        The output is renamed to FILENAME_<profile or tracker>.parquet so each run keeps its own copy.
+    '''
+    label = profile if tracker == "csrt" else tracker
+    result = subprocess.run([EXECUTABLE, FILEPATH, "-t", "--tracker", tracker, "--profile", profile] + ARGS, capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(label + " run failed:\n" + result.stderr)
+    elapsed = float(re.search(r"Elapsed time: ([0-9.e+-]+) s", result.stdout).group(1))
+
+    stem = os.path.splitext(os.path.basename(FILEPATH))[0]
+    out_file = stem + "_" + label + ".parquet"
+    os.replace(stem + "_out.parquet", out_file)
+    return elapsed, out_file
+
+def drift(reference, data):
+    '''
+        Mean and max euclidean distance (microns) between the droplet positions of two runs, over the frames both tracked.
+    '''
+    numDroplets = len([name for name in reference.columns if name.startswith("x_")])
+    distances = []
+    for i in range(numDroplets):
+        dx = data["x_" + str(i)].to_numpy() - reference["x_" + str(i)].to_numpy()
+        dy = data["y_" + str(i)].to_numpy() - reference["y_" + str(i)].to_numpy()
+        distances.append(np.sqrt(dx * dx + dy * dy))
+    distances = np.concatenate(distances)
+    return np.nanmean(distances), np.nanmax(distances)
+
+def bench_profiles(EXECUTABLE, FILEPATH, TRACKERS, ARGS):
+    '''
+        Tracks FILEPATH once per CSRT profile and once per other tracker in TRACKERS, and reports fps and positional drift
+        against the accurate CSRT profile.
+        ARGS must select droplets headlessly (--rois FILE or --detect) so every run starts from the same bboxes.
+    '''
+    runs = [("csrt", profile) for profile in PROFILES] + [(tracker, "accurate") for tracker in TRACKERS if tracker != "csrt"]
+    results = {}
+    for tracker, profile in runs:
+        label = profile if tracker == "csrt" else tracker
+        results[label] = run_profile(EXECUTABLE, FILEPATH, ARGS, tracker, profile)
+
+    reference = pd.read_parquet(results["accurate"][1])
+    numRows = len(reference)
+    print("run\t\tfps\t\tmean drift (um)\tmax drift (um)")
+    for label, (elapsed, out_file) in results.items():
+        mean, worst = drift(reference, pd.read_parquet(out_file))
+        print("%s\t%s%.2f\t\t%.3f\t\t%.3f" % (label, "\t" if len(label) < 8 else "", numRows / elapsed, mean, worst))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="benchmark CSRT profiles and other trackers against the accurate CSRT profile")
+    parser.add_argument("EXECUTABLE", help="path to tracking executable")
+    parser.add_argument("FILEPATH", help="path to video file")
+    parser.add_argument("-T", "--trackers", default="kcf mosse centroid shared", help="trackers run besides the CSRT profiles (Default: 'kcf mosse centroid shared')")
+    parser.add_argument("ARGS", nargs=argparse.REMAINDER, help="remaining tracking arguments (e.g. -n 2 -px 146.8 -pd 200 -d '20 10' --rois seeds.csv)")
+
+    args = parser.parse_args()
+    bench_profiles(args.EXECUTABLE, args.FILEPATH, args.trackers.split(), args.ARGS)
@@ -0,0 +1,112 @@
+import argparse
+import re
+import subprocess
+import cv2
+import numpy as np
+import pandas as pd
+
+def brownian(WIDTH, HEIGHT, FRAMES, DIAMETERS, STEP, rng):
+    '''
+        True centre (px) of every droplet on every frame, shape (FRAMES, droplets, 2).
+        Droplets start evenly spaced across the middle of the frame and take Gaussian steps of STEP px
+        per axis each frame, reflected off the frame border.
+    '''
+    numDroplets = len(DIAMETERS)
+    radii = np.array(DIAMETERS)[:, None] / 2
+    low = radii + 2
+    high = np.array([WIDTH, HEIGHT]) - radii - 2
+
+    centres = np.empty((FRAMES, numDroplets, 2))
+    centres[0, :, 0] = (np.arange(numDroplets) + 0.5) * WIDTH / numDroplets
+    centres[0, :, 1] = HEIGHT / 2
+    for j in range(1, FRAMES):
+        position = centres[j - 1] + rng.normal(0, STEP, (numDroplets, 2))
+        position = np.where(position < low, 2 * low - position, position)
+        position = np.where(position > high, 2 * high - position, position)
+        centres[j] = position
+    return centres
+
+def make_video(FILEPATH, WIDTH, HEIGHT, FPS, DIAMETERS, NOISE, centres, rng):
+    '''
+        Writes dark anti-aliased droplets at the given centres on a light background with Gaussian noise
+        of standard deviation NOISE grey levels (MJPG, so it decodes with any OpenCV build).
+    '''
+    writer = cv2.VideoWriter(FILEPATH, cv2.VideoWriter_fourcc(*"MJPG"), FPS, (WIDTH, HEIGHT))
+    for frameCentres in centres:
+        frame = np.full((HEIGHT, WIDTH), 200, np.float32)
+        for (x, y), diameter in zip(frameCentres, DIAMETERS):
+            # Sub-pixel centre and radius in 1/16 px
+            cv2.circle(frame, (int(round(x * 16)), int(round(y * 16))), int(round(diameter * 8)), 60, -1, cv2.LINE_AA, 4)
+        frame += rng.normal(0, NOISE, frame.shape)
+        writer.write(cv2.cvtColor(np.clip(frame, 0, 255).astype(np.uint8), cv2.COLOR_GRAY2BGR))
+    writer.release()
+
+def track(EXECUTABLE, DIAMETERS, ARGS, centres):
+    '''
+        Tracks synthetic.avi from synthetic_rois.csv and returns (elapsed seconds, executable output, error of every droplet
+        on every frame in px with NaN where the droplet was lost).
+    '''
+    # 1 px between plates per micron so positions come back in px
+    command = [EXECUTABLE, "synthetic.avi", "-n", str(len(DIAMETERS)), "-px", "1", "-pd", "1", "-d", " ".join(str(d) for d in DIAMETERS),
+        "--rois", "synthetic_rois.csv", "-t"] + ARGS
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError("tracking failed:\n" + result.stderr)
+    elapsed = float(re.search(r"Elapsed time: ([0-9.e+-]+) s", result.stdout).group(1))
+
+    data = pd.read_parquet("synthetic_out.parquet")
+    errors = []
+    for i in range(len(DIAMETERS)):
+        dx = data["x_" + str(i)].to_numpy() - centres[:len(data), i, 0]
+        dy = data["y_" + str(i)].to_numpy() - centres[:len(data), i, 1]
+        errors.append(np.sqrt(dx * dx + dy * dy))
+    return elapsed, result.stdout, np.stack(errors, axis=1)
+
+def bench_synthetic(EXECUTABLE, WIDTH, HEIGHT, FRAMES, FPS, DIAMETERS, NOISE, STEP, SEED, GRAY, ARGS):
+    '''
+        Generates a synthetic video with known droplet trajectories, tracks it headlessly from the true
+        first-frame bboxes and reports throughput, stage latencies and the error against the ground truth.
+        With GRAY it is tracked a second time with -g so the BGR and gray paths can be compared.
+    '''
+    rng = np.random.default_rng(SEED)
+    centres = brownian(WIDTH, HEIGHT, FRAMES, DIAMETERS, STEP, rng)
+    make_video("synthetic.avi", WIDTH, HEIGHT, FPS, DIAMETERS, NOISE, centres, rng)
+
+    # Seeds and ground truth next to the video
+    with open("synthetic_rois.csv", "w") as rois:
+        for (x, y), diameter in zip(centres[0], DIAMETERS):
+            rois.write("%d,%d,%d,%d\n" % (round(x - diameter / 2), round(y - diameter / 2), round(diameter), round(diameter)))
+    frames, droplets = np.meshgrid(np.arange(FRAMES), np.arange(len(DIAMETERS)), indexing="ij")
+    pd.DataFrame({"frame": frames.ravel(), "droplet": droplets.ravel(), "x": centres[:, :, 0].ravel(), "y": centres[:, :, 1].ravel()}).to_csv("synthetic_truth.csv", index=False)
+
+    print("%dx%d, %d frames, %d droplets, noise %.1f, step %.2f px" % (WIDTH, HEIGHT, FRAMES, len(DIAMETERS), NOISE, STEP))
+    runs = [("bgr", ARGS), ("gray", ARGS + ["-g"])] if GRAY else [("", ARGS)]
+    for name, runArgs in runs:
+        elapsed, output, errors = track(EXECUTABLE, DIAMETERS, runArgs, centres)
+        lost = np.count_nonzero(np.isnan(errors)) + np.count_nonzero(errors > np.array(DIAMETERS) / 2)
+        if name:
+            print("\n" + name + ":")
+        print("throughput:\t%.2f fps (%.3f s)" % (FRAMES / elapsed, elapsed))
+        for line in output.splitlines():
+            if "percentiles" in line or line.startswith("Stage") or line.startswith("Tracker input"):
+                print(line)
+        print("error (px):\t%.3f mean, %.3f p95, %.3f max" % (np.nanmean(errors), np.nanpercentile(errors, 95), np.nanmax(errors)))
+        print("lost:\t\t%d of %d droplet frames lost or off by more than a radius" % (lost, errors.size))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="benchmark tracking on a synthetic video with known trajectories")
+    parser.add_argument("EXECUTABLE", help="path to tracking executable")
+    parser.add_argument("--width", type=int, default=640, help="frame width in px (Default: 640)")
+    parser.add_argument("--height", type=int, default=480, help="frame height in px (Default: 480)")
+    parser.add_argument("-f", "--frames", type=int, default=300, help="number of frames (Default: 300)")
+    parser.add_argument("--fps", type=float, default=30, help="frame rate of the video (Default: 30)")
+    parser.add_argument("-d", "--diameters", default="40 30", help="droplet diameters in px, one per droplet (Default: '40 30')")
+    parser.add_argument("--noise", type=float, default=8, help="standard deviation of pixel noise in grey levels (Default: 8)")
+    parser.add_argument("--step", type=float, default=1.5, help="standard deviation of each Brownian step in px (Default: 1.5)")
+    parser.add_argument("--seed", type=int, default=0, help="random seed (Default: 0)")
+    parser.add_argument("-g", "--gray", action="store_true", help="also tracks with -g and reports both runs (needs a --tracker other than csrt in ARGS)")
+    parser.add_argument("ARGS", nargs=argparse.REMAINDER, help="extra tracking arguments (e.g. --profile fast -j 2)")
+
+    args = parser.parse_args()
+    bench_synthetic(args.EXECUTABLE, args.width, args.height, args.frames, args.fps, [float(d) for d in args.diameters.split()],
+        args.noise, args.step, args.seed, args.gray, args.ARGS)
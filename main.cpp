@@ -4,12 +4,21 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <functional>
 #include <arrow/api.h>
 #include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <parquet/arrow/reader.h>
 #include <parquet/arrow/writer.h>
 #include <parquet/exception.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/tracking.hpp>
+#include <opencv2/tracking/tracking_legacy.hpp>
 #include <opencv2/core.hpp>
 
 /*
@@ -17,19 +26,29 @@
 	is (9.32228 s w/ --show : 7.1656 s w/o --show)
 */
 
-// Global variables
-std::string PATH = "";
-int NUM_DROPLETS = 0, NUM_FRAMES = 0;
-double PX_DISTANCE = 0.0, DISTANCE = 0.0, FPS = 0.0, DENSITY = 1000.0;
-std::vector<double> DIAMETERS;
-bool TIMEIT = false, SHOW = false;
+// Options of one video, parsed from its command line and passed to everything that tracks it (--batch tracks several at once)
+// NUM_FRAMES, FPS and DIAMETERS (converted from px to microns) are updated once the video is opened
+struct Options {
+	std::string PATH = "";
+	int NUM_DROPLETS = 0, NUM_FRAMES = 0, THREADS = 1, RING_DEPTH = 0, CROP_MARGIN = -1, STREAM_ROWS = 0, ROW_GROUP_ROWS = 65536, CHECKPOINT_FRAMES = 0;
+	int SEGMENTS = 1, OVERLAP_FRAMES = 30, OVERLAY_EVERY = 1;
+	double PX_DISTANCE = 0.0, DISTANCE = 0.0, FPS = 0.0, DENSITY = 1000.0, OVERLAY_SCALE = 1.0;
+	std::vector<double> DIAMETERS;
+	std::string ROIS_PATH = "", TRACKER = "csrt", PROFILE = "accurate", PARAMS_PATH = "";
+	std::string COMPRESSION = "none", ENCODING = "dictionary", FORMAT = "parquet", TRACE_PATH = "", OVERLAY_PATH = "";
+	std::vector<cv::Rect> SEED_BBOXES;
+	std::vector<int> SEED_FRAMES;
+	bool TIMEIT = false, SHOW = false, DETECT = false, GRAY = false, LONG = false, ANALYSIS = false, STATISTICS = true, RESUME = false, BATCH = false, KALMAN = false, RECOVERY = true;
+};
 
 // Displays help for program
 void display_help(char** argv) {
-	std::cerr << "usage: " << argv[0] << " FILEPATH" << " [-h]" << " -n DROPLETS" << " -px PIXELS" << " -pd DISTANCE" << " -d DIAMETERS" << " [-rho DENSITY]" << " [-t]" << " [-s]" << std::endl;
+	std::cerr << "usage: " << argv[0] << " FILEPATH | --batch MANIFEST [--jobs JOBS]" << " [-h]" << " -n DROPLETS" << " -px PIXELS" << " -pd DISTANCE" << " -d DIAMETERS" << " [-rho DENSITY]" << " [-j THREADS]" << " [-r DEPTH]" << " [--rois FILE | --detect]" << " [--tracker TRACKER]" << " [--profile PROFILE]" << " [--params FILE]" << " [--crop MARGIN]" << " [-g]" << " [--stream ROWS]" << " [-l]" << " [-a]" << " [--row-group ROWS]" << " [--compression CODEC]" << " [--encoding ENCODING]" << " [--no-statistics]" << " [--format FORMAT]" << " [--checkpoint FRAMES]" << " [--resume]" << " [--segments K]" << " [--overlap FRAMES]" << " [--trace FILE]" << " [--overlay-out FILE]" << " [--overlay-scale SCALE]" << " [--overlay-every K]" << " [-k]" << " [--no-recovery]" << " [-t]" << " [-s]" << std::endl;
 	std::cerr << std::endl;
 	std::cerr << "positional arguments:" << std::endl;
 	std::cerr << " FILEPATH\t\tpath to video file (e.g. .mov, .mp4, etc.)" << std::endl;
+	std::cerr << " --batch MANIFEST\ttracks every 'FILEPATH [options]' line of MANIFEST, other options apply to all of them" << std::endl;
+	std::cerr << " --jobs JOBS\t\tnumber of videos tracked at once in batch mode (Default: 1)" << std::endl;
 	std::cerr << std::endl;
 	std::cerr << "required arguments:" << std::endl;
 	std::cerr << " -n DROPLETS, --droplets DROPLETS\n\t\t\tnumber of droplets to track" << std::endl;
@@ -38,34 +57,61 @@ void display_help(char** argv) {
 	std::cerr << " -d DIAMETERS, --diameters DIAMETERS\n\t\t\tdiameter of each droplet in pixels (e.g. '20.5 10')" << std::endl;
 	std::cerr << "options:" << std::endl;
 	std::cerr << " -rho DENSITY, --density DENSITY\n\t\t\tdensity of droplets in kg/m^3 (Default: 1000)" << std::endl;
+	std::cerr << " -j THREADS, --threads THREADS\n\t\t\tnumber of threads updating trackers each frame (Default: 1)" << std::endl;
+	std::cerr << " -r DEPTH, --ring DEPTH\n\t\t\tdecode up to DEPTH frames ahead on a separate thread (Default: 0, decode inline)" << std::endl;
+	std::cerr << " --rois FILE\t\tread initial bboxes from FILE ('x,y,w,h[,frame]' per droplet) instead of selecting them" << std::endl;
+	std::cerr << " --detect\t\tdetect droplets on the first frame from DIAMETERS instead of selecting them" << std::endl;
+	std::cerr << " --tracker TRACKER\ttracking algorithm: csrt, kcf, mosse, centroid or shared (Default: csrt)" << std::endl;
+	std::cerr << " --profile PROFILE\tCSRT preset: fast, balanced or accurate (Default: accurate)" << std::endl;
+	std::cerr << " --params FILE\t\tCSRT parameters overriding the preset (OpenCV YAML/JSON/XML, e.g. 'admm_iterations: 2')" << std::endl;
+	std::cerr << " --crop MARGIN\t\ttrack only inside the initial bboxes padded by MARGIN pixels" << std::endl;
+	std::cerr << " -g, --gray\t\ttracks on single-channel frames (for monochrome footage, not with csrt)" << std::endl;
+	std::cerr << " --stream ROWS\t\twrites output every ROWS frames while tracking instead of at the end" << std::endl;
+	std::cerr << " -l, --long\t\twrites one row per droplet and frame (DIAMETERS, DENSITY, FPS in file metadata)" << std::endl;
+	std::cerr << " -a, --analysis\t\tadds velocity, acceleration and force of each droplet to the output" << std::endl;
+	std::cerr << " --row-group ROWS\tmaximum rows per parquet row group (Default: 65536)" << std::endl;
+	std::cerr << " --compression CODEC\tparquet compression: none, snappy, lz4 or zstd (Default: none)" << std::endl;
+	std::cerr << " --encoding ENCODING\tencoding of float columns: plain, dictionary or split (BYTE_STREAM_SPLIT) (Default: dictionary)" << std::endl;
+	std::cerr << " --no-statistics\tdoes not write parquet column statistics" << std::endl;
+	std::cerr << " --format FORMAT\t\toutput file format: parquet, feather or ipc (Default: parquet)" << std::endl;
+	std::cerr << " --checkpoint FRAMES\tsaves the tracking state every FRAMES frames" << std::endl;
+	std::cerr << " --resume\t\tcontinues from the last checkpoint of an interrupted run" << std::endl;
+	std::cerr << " --segments K\t\tsplits the video into K time segments tracked in parallel" << std::endl;
+	std::cerr << " --overlap FRAMES\tframes each segment re-tracks before its start for stitching (Default: 30)" << std::endl;
+	std::cerr << " --trace FILE\t\twrites the time of every tracking stage to FILE as Chrome trace events (JSON)" << std::endl;
+	std::cerr << " --overlay-out FILE\twrites the video with droplet bboxes and numbers drawn on it to FILE (.avi: MJPG, otherwise mp4v)" << std::endl;
+	std::cerr << " --overlay-scale SCALE\tresizes overlay frames by SCALE (Default: 1)" << std::endl;
+	std::cerr << " --overlay-every K\twrites every K-th frame to the overlay (Default: 1)" << std::endl;
+	std::cerr << " -k, --kalman\t\tcentres each tracker's search on a Kalman prediction and adds the filtered state to the output" << std::endl;
+	std::cerr << " --no-recovery\t\tkeeps updating a lost droplet's tracker instead of re-detecting the droplet" << std::endl;
 	std::cerr << " -h, --help\t\tshow this help message and exit" << std::endl;
 	std::cerr << " -t, --timeit\t\tprints run-time of tracking algorithm" << std::endl;
 	std::cerr << " -s, --show\t\tdisplays video with trackers" << std::endl;
 }
 
 // Gets necessary arguments from command line
-int parse_args(int argc, char** argv) {
+int parse_args(int argc, char** argv, Options &opt) {
 	for(int i = 1; i < argc; i++) {
 		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
 			display_help(argv);
 			return 1;
 		} else if(strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--droplets") == 0) {
 			if(i + 1 < argc) {
-				NUM_DROPLETS = std::strtol(argv[++i], NULL, 10);
+				opt.NUM_DROPLETS = std::strtol(argv[++i], NULL, 10);
 			} else {
 				std::cerr << "-n DROPLETS option requires one argument" << std::endl;
 				return 1;
 			}
 		} else if(strcmp(argv[i], "-px") == 0 || strcmp(argv[i], "--pixels") == 0) {
 			if(i + 1 < argc) {
-				PX_DISTANCE = std::strtod(argv[++i], NULL);
+				opt.PX_DISTANCE = std::strtod(argv[++i], NULL);
 			} else {
 				std::cerr << "-px PIXELS option requires one argument" << std::endl;
 				return 1;
 			}
 		} else if(strcmp(argv[i], "-pd") == 0 || strcmp(argv[i], "--distance") == 0) {
 			if(i + 1 < argc) {
-				DISTANCE = std::strtod(argv[++i], NULL);
+				opt.DISTANCE = std::strtod(argv[++i], NULL);
 			} else {
 				std::cerr << "-pd DISTANCE option requires one argument" << std::endl;
 				return 1;
@@ -75,8 +121,9 @@ int parse_args(int argc, char** argv) {
 				std::string sDiameters = argv[++i];
 				std::stringstream ss(sDiameters);
 				std::string sDiameter;
+				opt.DIAMETERS.clear();
 				while(ss >> sDiameter) {
-					DIAMETERS.push_back(std::stod(sDiameter));
+					opt.DIAMETERS.push_back(std::stod(sDiameter));
 				}
 			} else {
 				std::cerr << "-d DIAMETERS option requires atleast one argument" << std::endl;
@@ -84,264 +131,2847 @@ int parse_args(int argc, char** argv) {
 			}
 		} else if(strcmp(argv[i], "-rho") == 0 || strcmp(argv[i], "--density") == 0) {
 			if(i + 1 < argc) {
-				DENSITY = std::strtod(argv[++i], NULL);
+				opt.DENSITY = std::strtod(argv[++i], NULL);
 			} else {
 				std::cerr << "-rho DENSITY option requires one arguement" << std::endl;
 				return 1;
 			}
+		} else if(strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+			if(i + 1 < argc) {
+				opt.THREADS = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "-j THREADS option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--ring") == 0) {
+			if(i + 1 < argc) {
+				opt.RING_DEPTH = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "-r DEPTH option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--rois") == 0) {
+			if(i + 1 < argc) {
+				opt.ROIS_PATH = argv[++i];
+			} else {
+				std::cerr << "--rois FILE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--detect") == 0) {
+			opt.DETECT = true;
+		} else if(strcmp(argv[i], "--tracker") == 0) {
+			if(i + 1 < argc) {
+				opt.TRACKER = argv[++i];
+			} else {
+				std::cerr << "--tracker TRACKER option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--profile") == 0) {
+			if(i + 1 < argc) {
+				opt.PROFILE = argv[++i];
+			} else {
+				std::cerr << "--profile PROFILE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--params") == 0) {
+			if(i + 1 < argc) {
+				opt.PARAMS_PATH = argv[++i];
+			} else {
+				std::cerr << "--params FILE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--crop") == 0) {
+			if(i + 1 < argc) {
+				opt.CROP_MARGIN = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--crop MARGIN option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--gray") == 0) {
+			opt.GRAY = true;
+		} else if(strcmp(argv[i], "--stream") == 0) {
+			if(i + 1 < argc) {
+				opt.STREAM_ROWS = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--stream ROWS option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--long") == 0) {
+			opt.LONG = true;
+		} else if(strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--analysis") == 0) {
+			opt.ANALYSIS = true;
+		} else if(strcmp(argv[i], "--row-group") == 0) {
+			if(i + 1 < argc) {
+				opt.ROW_GROUP_ROWS = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--row-group ROWS option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--compression") == 0) {
+			if(i + 1 < argc) {
+				opt.COMPRESSION = argv[++i];
+			} else {
+				std::cerr << "--compression CODEC option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--encoding") == 0) {
+			if(i + 1 < argc) {
+				opt.ENCODING = argv[++i];
+			} else {
+				std::cerr << "--encoding ENCODING option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--no-statistics") == 0) {
+			opt.STATISTICS = false;
+		} else if(strcmp(argv[i], "--format") == 0) {
+			if(i + 1 < argc) {
+				opt.FORMAT = argv[++i];
+			} else {
+				std::cerr << "--format FORMAT option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--checkpoint") == 0) {
+			if(i + 1 < argc) {
+				opt.CHECKPOINT_FRAMES = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--checkpoint FRAMES option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--resume") == 0) {
+			opt.RESUME = true;
+		} else if(strcmp(argv[i], "--segments") == 0) {
+			if(i + 1 < argc) {
+				opt.SEGMENTS = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--segments K option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--overlap") == 0) {
+			if(i + 1 < argc) {
+				opt.OVERLAP_FRAMES = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--overlap FRAMES option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--trace") == 0) {
+			if(i + 1 < argc) {
+				opt.TRACE_PATH = argv[++i];
+			} else {
+				std::cerr << "--trace FILE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--overlay-out") == 0) {
+			if(i + 1 < argc) {
+				opt.OVERLAY_PATH = argv[++i];
+			} else {
+				std::cerr << "--overlay-out FILE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--overlay-scale") == 0) {
+			if(i + 1 < argc) {
+				opt.OVERLAY_SCALE = std::strtod(argv[++i], NULL);
+			} else {
+				std::cerr << "--overlay-scale SCALE option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--overlay-every") == 0) {
+			if(i + 1 < argc) {
+				opt.OVERLAY_EVERY = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--overlay-every K option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--kalman") == 0) {
+			opt.KALMAN = true;
+		} else if(strcmp(argv[i], "--no-recovery") == 0) {
+			opt.RECOVERY = false;
 		} else if(strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--timeit") == 0) {
-			TIMEIT = true;
+			opt.TIMEIT = true;
 		} else if(strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--show") == 0) {
-			SHOW = true;
-		} else if(PATH.compare("") == 0) {
+			opt.SHOW = true;
+		} else if(opt.PATH.compare("") == 0) {
 			std::ifstream test(argv[i]);
 			if(!test) {
 				std::cerr << argv[i] << " does not exist or is not a file" << std::endl;
 				return -1;
 			} else {
-				PATH = argv[i];
+				opt.PATH = argv[i];
+			}
+		} else {
+			std::cerr << "unkown argument: " << argv[i] << std::endl;
+			display_help(argv);
+			return 1;
+		}
+	}
+	if(opt.PATH.compare("") == 0) {
+		std::cerr << "requires FILEPATH" << std::endl;
+		return 1;
+	}
+	if(opt.NUM_DROPLETS == 0) {
+		std::cerr << "requires -n DROPLETS" << std::endl;
+		return 1;
+	}
+	if(opt.PX_DISTANCE == 0.0) {
+		std::cerr << "requires -px PIXELS" << std::endl;
+		return 1;
+	}
+	if(opt.DISTANCE == 0.0) {
+		std::cerr << "requires -pd DISTANCE" << std::endl;
+		return 1;
+	}
+	if(opt.DIAMETERS.size() == 0) {
+		std::cerr << "requires -d DIAMETERS" << std::endl;
+		return 1;
+	}
+	if(opt.THREADS < 1) {
+		std::cerr << "-j THREADS must be at least 1" << std::endl;
+		return 1;
+	}
+	if(opt.RING_DEPTH < 0) {
+		std::cerr << "-r DEPTH must not be negative" << std::endl;
+		return 1;
+	}
+	if(opt.TRACKER != "csrt" && opt.TRACKER != "kcf" && opt.TRACKER != "mosse" && opt.TRACKER != "centroid" && opt.TRACKER != "shared") {
+		std::cerr << "unknown tracker: " << opt.TRACKER << std::endl;
+		return 1;
+	}
+	if(opt.STREAM_ROWS < 0) {
+		std::cerr << "--stream ROWS must not be negative" << std::endl;
+		return 1;
+	}
+	if(opt.CHECKPOINT_FRAMES < 0) {
+		std::cerr << "--checkpoint FRAMES must not be negative" << std::endl;
+		return 1;
+	}
+	if(opt.ROW_GROUP_ROWS < 1) {
+		std::cerr << "--row-group ROWS must be at least 1" << std::endl;
+		return 1;
+	}
+	if(opt.COMPRESSION != "none" && opt.COMPRESSION != "snappy" && opt.COMPRESSION != "lz4" && opt.COMPRESSION != "zstd") {
+		std::cerr << "unknown compression: " << opt.COMPRESSION << std::endl;
+		return 1;
+	}
+	if(opt.ENCODING != "plain" && opt.ENCODING != "dictionary" && opt.ENCODING != "split") {
+		std::cerr << "unknown encoding: " << opt.ENCODING << std::endl;
+		return 1;
+	}
+	if(opt.FORMAT != "parquet" && opt.FORMAT != "feather" && opt.FORMAT != "ipc") {
+		std::cerr << "unknown format: " << opt.FORMAT << std::endl;
+		return 1;
+	}
+	if(opt.FORMAT != "parquet" && opt.COMPRESSION == "snappy") {
+		std::cerr << "--format " << opt.FORMAT << " supports --compression none, lz4 or zstd" << std::endl;
+		return 1;
+	}
+	if(opt.CROP_MARGIN < -1) {
+		std::cerr << "--crop MARGIN must not be negative" << std::endl;
+		return 1;
+	}
+	if(opt.PROFILE != "fast" && opt.PROFILE != "balanced" && opt.PROFILE != "accurate") {
+		std::cerr << "unknown profile: " << opt.PROFILE << std::endl;
+		return 1;
+	}
+	if(opt.GRAY && opt.TRACKER == "csrt") {
+		std::cerr << "--gray cannot be used with --tracker csrt (CSRT converts single-channel frames back to BGR for every droplet)" << std::endl;
+		return 1;
+	}
+	if(opt.DETECT && opt.ROIS_PATH.compare("") != 0) {
+		std::cerr << "--rois FILE and --detect cannot be used together" << std::endl;
+		return 1;
+	}
+	if(opt.SEGMENTS < 1 || opt.OVERLAP_FRAMES < 1) {
+		std::cerr << "--segments K and --overlap FRAMES must be at least 1" << std::endl;
+		return 1;
+	}
+	if(opt.SEGMENTS > 1 && (opt.STREAM_ROWS > 0 || opt.CHECKPOINT_FRAMES > 0 || opt.RESUME || opt.SHOW)) {
+		std::cerr << "--segments K cannot be used with --stream, --checkpoint, --resume or -s" << std::endl;
+		return 1;
+	}
+	if(opt.OVERLAY_SCALE <= 0.0 || opt.OVERLAY_EVERY < 1) {
+		std::cerr << "--overlay-scale SCALE must be positive and --overlay-every K at least 1" << std::endl;
+		return 1;
+	}
+	if(opt.SEGMENTS > 1 && (opt.OVERLAY_PATH.compare("") != 0 || opt.KALMAN || opt.TRACE_PATH.compare("") != 0 || opt.THREADS > 1 || opt.RING_DEPTH > 0 || !opt.RECOVERY)) {
+		std::cerr << "--segments K cannot be used with --overlay-out, -k, --trace, -j, -r or --no-recovery" << std::endl;
+		return 1;
+	}
+	if(opt.BATCH && (opt.SEGMENTS > 1 || opt.SHOW || (!opt.DETECT && opt.ROIS_PATH.compare("") == 0))) {
+		std::cerr << opt.PATH << ": videos in --batch mode need --rois FILE or --detect and cannot use --segments or -s" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Reads one 'x,y,w,h[,frame]' bbox per droplet from ROIS_PATH (blank lines and lines starting with '#' are skipped)
+int load_rois(Options &opt) {
+	std::ifstream file(opt.ROIS_PATH);
+	if(!file) {
+		std::cerr << opt.ROIS_PATH << " does not exist or is not a file" << std::endl;
+		return 1;
+	}
+	std::string line;
+	int line_num = 0;
+	while(std::getline(file, line)) {
+		line_num++;
+		if(line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t")] == '#') {
+			continue;
+		}
+		std::replace(line.begin(), line.end(), ',', ' ');
+		std::stringstream ss(line);
+		int x, y, w, h, start = 0;
+		if(!(ss >> x >> y >> w >> h) || w <= 0 || h <= 0) {
+			std::cerr << opt.ROIS_PATH << ":" << line_num << ": expected 'x,y,w,h[,frame]'" << std::endl;
+			return 1;
+		}
+		if(ss >> start && start < 0) {
+			std::cerr << opt.ROIS_PATH << ":" << line_num << ": start frame must not be negative" << std::endl;
+			return 1;
+		}
+		opt.SEED_BBOXES.push_back(cv::Rect(x, y, w, h));
+		opt.SEED_FRAMES.push_back(start);
+	}
+	if(opt.SEED_BBOXES.size() != opt.NUM_DROPLETS) {
+		std::cerr << opt.ROIS_PATH << " has " << opt.SEED_BBOXES.size() << " bboxes but -n DROPLETS is " << opt.NUM_DROPLETS << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Tracked positions (microns) of every droplet, row r holding frame first_row + r
+// All values share one buffer from the Arrow memory pool laid out by quantity, then droplet, then frame, so each
+// droplet's x (or y, w, h) is frame-contiguous and can be handed to Arrow without copying
+// Bbox sizes and success flags (one Arrow validity-style bitmap per droplet) are only kept for the long output
+class Trajectories {
+public:
+	// KX, KY, KVX, KVY are the Kalman-filtered centre and velocity (--kalman)
+	enum Quantity { X, Y, W, H, KX, KY, KVX, KVY, NUM_QUANTITIES };
+
+	Trajectories(int num_droplets, bool sizes, bool filtered = false) : prev_x(num_droplets, 0.0), prev_y(prev_x), prev2_x(prev_x), prev2_y(prev_x),
+		num_droplets(num_droplets), num_quantities(0) {
+		// Quantities not kept get no slot in the buffer
+		for(int q = 0; q < NUM_QUANTITIES; q++) {
+			bool kept = q <= Y || (q <= H ? sizes : filtered);
+			slots[q] = kept ? num_quantities++ : -1;
+		}
+	}
+
+	// Grows the buffer so it holds at least num_rows rows, keeping the rows stored so far
+	// Capacity at least doubles so a video whose frame count was under-reported is copied O(log frames) times
+	arrow::Status reserve(int num_rows) {
+		if(num_rows <= capacity) {
+			return arrow::Status::OK();
+		}
+		int new_capacity = std::max(num_rows, 2 * capacity);
+		std::shared_ptr<arrow::Buffer> grown;
+		ARROW_ASSIGN_OR_RAISE(grown, arrow::AllocateBuffer(bytes(new_capacity)));
+		std::memset(grown->mutable_data(), 0, grown->size());
+		// The first call has no rows to keep
+		if(buffer) {
+			for(int q = 0; q < NUM_QUANTITIES; q++) {
+				for(int i = 0; i < num_droplets && slots[q] >= 0; i++) {
+					std::memcpy((double*)grown->mutable_data() + ((size_t)slots[q] * num_droplets + i) * new_capacity, values((Quantity)q, i), capacity * sizeof(double));
+				}
+			}
+			if(sizes()) {
+				for(int i = 0; i < num_droplets; i++) {
+					std::memcpy(grown->mutable_data() + (size_t)num_quantities * num_droplets * new_capacity * sizeof(double)
+						+ (size_t)i * arrow::bit_util::BytesForBits(new_capacity), ok(i), arrow::bit_util::BytesForBits(capacity));
+				}
+			}
+		}
+		buffer = std::move(grown);
+		capacity = new_capacity;
+		return arrow::Status::OK();
+	}
+
+	int rows() const { return capacity; }
+	bool sizes() const { return slots[W] >= 0; }
+	bool filtered() const { return slots[KX] >= 0; }
+
+	double* values(Quantity q, int i) {
+		return (double*)buffer->mutable_data() + ((size_t)slots[q] * num_droplets + i) * capacity;
+	}
+
+	uint8_t* ok(int i) {
+		return buffer->mutable_data() + (size_t)num_quantities * num_droplets * capacity * sizeof(double) + (size_t)i * arrow::bit_util::BytesForBits(capacity);
+	}
+
+	// Zero-copy view of the first num_rows values of quantity q for droplet i
+	std::shared_ptr<arrow::Buffer> slice(Quantity q, int i, int num_rows) {
+		return arrow::SliceBuffer(buffer, (uint8_t*)values(q, i) - buffer->data(), (int64_t)num_rows * sizeof(double));
+	}
+
+	// Zero-copy view of the first num_rows success flags for droplet i
+	std::shared_ptr<arrow::Buffer> slice_ok(int i, int num_rows) {
+		return arrow::SliceBuffer(buffer, ok(i) - buffer->data(), arrow::bit_util::BytesForBits(num_rows));
+	}
+
+	// Records droplet i's bbox for frame j
+	void store(int i, int j, const cv::Rect &bbox, double ratio) {
+		int r = j - first_row;
+		values(X, i)[r] = (bbox.x + bbox.width / 2) * ratio;
+		values(Y, i)[r] = (bbox.y + bbox.height / 2) * ratio;
+		if(sizes()) {
+			values(W, i)[r] = bbox.width * ratio;
+			values(H, i)[r] = bbox.height * ratio;
+			arrow::bit_util::SetBit(ok(i), r);
+		}
+	}
+
+	// Marks frame j as a gap in droplet i's track (NaN position and size, ok stays false)
+	void store_gap(int i, int j) {
+		int r = j - first_row;
+		for(Quantity q : {X, Y, W, H}) {
+			if(slots[q] >= 0) {
+				values(q, i)[r] = std::numeric_limits<double>::quiet_NaN();
+			}
+		}
+	}
+
+	// Marks frame j as before droplet i's tracker started (a gap with no filtered state either)
+	void store_unseeded(int i, int j) {
+		int r = j - first_row;
+		for(int q = 0; q < NUM_QUANTITIES; q++) {
+			if(slots[q] >= 0) {
+				values((Quantity)q, i)[r] = std::numeric_limits<double>::quiet_NaN();
+			}
+		}
+	}
+
+	// Records droplet i's filtered state (centre in px, velocity in px per frame) for frame j at fps frames per second
+	void store_filtered(int i, int j, const cv::Point2d &centre, const cv::Point2d &velocity, double ratio, double fps) {
+		int r = j - first_row;
+		values(KX, i)[r] = centre.x * ratio;
+		values(KY, i)[r] = centre.y * ratio;
+		values(KVX, i)[r] = velocity.x * ratio * fps;
+		values(KVY, i)[r] = velocity.y * ratio * fps;
+	}
+
+	// Drops the first num_rows rows and zeroes all rows so they can hold the frames following them
+	void advance(int num_rows) {
+		for(int i = 0; i < num_droplets; i++) {
+			const double *x = values(X, i), *y = values(Y, i);
+			prev2_x[i] = num_rows > 1 ? x[num_rows - 2] : prev_x[i];
+			prev2_y[i] = num_rows > 1 ? y[num_rows - 2] : prev_y[i];
+			prev_x[i] = x[num_rows - 1];
+			prev_y[i] = y[num_rows - 1];
+		}
+		first_row += num_rows;
+		std::memset(buffer->mutable_data(), 0, buffer->size());
+	}
+
+	int first_row = 0;
+
+	// Positions one and two frames before first_row (for differentiating across streamed blocks)
+	std::vector<double> prev_x, prev_y, prev2_x, prev2_y;
+
+private:
+	size_t bytes(int rows) const {
+		return (size_t)num_droplets * (rows * num_quantities * sizeof(double) + (sizes() ? arrow::bit_util::BytesForBits(rows) : 0));
+	}
+
+	int num_droplets, num_quantities, capacity = 0;
+	int slots[NUM_QUANTITIES];
+	std::shared_ptr<arrow::Buffer> buffer;
+};
+
+// Mass of droplet i in kg
+double droplet_mass(int i, const Options &opt) {
+	double diameter = opt.DIAMETERS[std::min(i, (int)opt.DIAMETERS.size() - 1)];
+	return opt.DENSITY * (2.0 / 3.0) * CV_PI * std::pow(diameter * 1e-6, 3);
+}
+
+// Derivative of pos (n frames starting at frame first, prev = value on frame first - 1) times fps, 0 on frame 0
+void differentiate(const double *pos, double prev, int n, int first, double fps, double *out) {
+	if(n == 0) {
+		return;
+	}
+	out[0] = first == 0 ? 0.0 : (pos[0] - prev) * fps;
+	for(int r = 1; r < n; r++) {
+		out[r] = (pos[r] - pos[r - 1]) * fps;
+	}
+}
+
+// Velocity (microns/s), acceleration (m/s^2) and force (N) of droplet i over the first num_rows rows of t
+// Returns vx, vy, ax, ay, Fx, Fy in that order, computed straight into Arrow memory pool buffers
+arrow::Result<arrow::ArrayVector> kinematics(Trajectories &t, int i, int num_rows, const Options &opt) {
+	std::shared_ptr<arrow::Buffer> out[6];
+	for(std::shared_ptr<arrow::Buffer> &column : out) {
+		ARROW_ASSIGN_OR_RAISE(column, arrow::AllocateBuffer((int64_t)num_rows * sizeof(double)));
+	}
+	const double mass = droplet_mass(i, opt);
+	for(int axis = 0; axis < 2; axis++) {
+		const double *pos = t.values(axis == 0 ? Trajectories::X : Trajectories::Y, i);
+		double prev = axis == 0 ? t.prev_x[i] : t.prev_y[i];
+		double prev2 = axis == 0 ? t.prev2_x[i] : t.prev2_y[i];
+		double *v = (double*)out[axis]->mutable_data(), *a = (double*)out[2 + axis]->mutable_data(), *f = (double*)out[4 + axis]->mutable_data();
+
+		// v(frame) = (pos(frame) - pos(frame - 1)) * FPS, a(frame) = (v(frame) - v(frame - 1)) * FPS, both 0 on frame 0
+		differentiate(pos, prev, num_rows, t.first_row, opt.FPS, v);
+		double prev_v = t.first_row > 1 ? (prev - prev2) * opt.FPS : 0.0;
+		differentiate(v, prev_v, num_rows, t.first_row, opt.FPS, a);
+		for(int r = 0; r < num_rows; r++) {
+			a[r] *= 1e-6;
+			f[r] = mass * a[r];
+		}
+	}
+
+	arrow::ArrayVector columns;
+	for(std::shared_ptr<arrow::Buffer> &column : out) {
+		columns.push_back(std::make_shared<arrow::DoubleArray>(num_rows, column));
+	}
+	return columns;
+}
+
+const char* KINEMATICS_NAMES[6] = {"vx", "vy", "ax", "ay", "Fx", "Fy"};
+
+// Column names of the Kalman-filtered centre (microns) and velocity (microns/s)
+const char* FILTERED_NAMES[4] = {"kx", "ky", "kvx", "kvy"};
+const Trajectories::Quantity FILTERED_QUANTITIES[4] = {Trajectories::KX, Trajectories::KY, Trajectories::KVX, Trajectories::KVY};
+
+// Builds the wide output table for rows [first_row, first_row + num_rows) from the first num_rows rows of t
+// Droplet columns view t directly instead of being copied
+arrow::Result<std::shared_ptr<arrow::Table>> make_table(Trajectories &t, int num_rows, const Options &opt) {
+	int first_row = t.first_row;
+
+	// Create fields (column names) and columns (data)
+	arrow::FieldVector fields;
+	std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+
+	// Store x,y data into arrow::Table for output
+	for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+		// Create fields for schema (how to store the data)
+		fields.push_back(arrow::field("x_" + std::to_string(i), arrow::float64()));
+		fields.push_back(arrow::field("y_" + std::to_string(i), arrow::float64()));
+
+		// Wrap droplet i's x and y rows as arrow::Arrays (no copy)
+		columns.push_back(std::make_shared<arrow::ChunkedArray>(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::X, i, num_rows))));
+		columns.push_back(std::make_shared<arrow::ChunkedArray>(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::Y, i, num_rows))));
+	}
+
+	// DIAMETERS (row i holds droplet i), DENSITY and FPS (first row only) are NULL on every other row, so each is
+	// stored as its few values followed by a slice of one shared array of NULLs
+	std::shared_ptr<arrow::Array> nulls;
+	ARROW_ASSIGN_OR_RAISE(nulls, arrow::MakeArrayOfNull(arrow::float64(), num_rows));
+	auto store_values = [&](const std::string &name, const std::vector<double> &values) -> arrow::Status {
+		int head = first_row < values.size() ? std::min((int)values.size() - first_row, num_rows) : 0;
+		arrow::DoubleBuilder dbuilder;
+		std::shared_ptr<arrow::Array> head_arr;
+		ARROW_RETURN_NOT_OK(dbuilder.AppendValues(values.data() + std::min(first_row, (int)values.size()), head));
+		ARROW_RETURN_NOT_OK(dbuilder.Finish(&head_arr));
+		fields.push_back(arrow::field(name, arrow::float64()));
+		columns.push_back(std::make_shared<arrow::ChunkedArray>(arrow::ArrayVector{head_arr, nulls->Slice(0, num_rows - head)}, arrow::float64()));
+		return arrow::Status::OK();
+	};
+	ARROW_RETURN_NOT_OK(store_values("DIAMETERS", opt.DIAMETERS));
+	ARROW_RETURN_NOT_OK(store_values("DENSITY", {opt.DENSITY}));
+	ARROW_RETURN_NOT_OK(store_values("FPS", {opt.FPS}));
+
+	// Store velocity, acceleration and force of each droplet
+	if(opt.ANALYSIS) {
+		arrow::ArrayVector kinematic_columns;
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			ARROW_ASSIGN_OR_RAISE(kinematic_columns, kinematics(t, i, num_rows, opt));
+			for(int c = 0; c < 6; c++) {
+				fields.push_back(arrow::field(KINEMATICS_NAMES[c] + std::string("_") + std::to_string(i), arrow::float64()));
+				columns.push_back(std::make_shared<arrow::ChunkedArray>(kinematic_columns[c]));
+			}
+		}
+	}
+
+	// Store filtered centre and velocity of each droplet
+	if(t.filtered()) {
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			for(int c = 0; c < 4; c++) {
+				fields.push_back(arrow::field(FILTERED_NAMES[c] + std::string("_") + std::to_string(i), arrow::float64()));
+				columns.push_back(std::make_shared<arrow::ChunkedArray>(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(FILTERED_QUANTITIES[c], i, num_rows))));
+			}
+		}
+	}
+
+	// Create schema and data table
+	std::shared_ptr<arrow::Schema> schema = arrow::schema(fields);
+	return arrow::Table::Make(schema, columns, num_rows);
+}
+
+// Builds the long output table (one row per droplet and frame, sorted by droplet then frame) from the first num_rows rows of t
+// Each column is chunked by droplet with the chunks viewing t directly
+arrow::Result<std::shared_ptr<arrow::Table>> make_long_table(Trajectories &t, int num_rows, const Options &opt) {
+	arrow::FieldVector fields = {
+		arrow::field("frame", arrow::int32()),
+		arrow::field("droplet", arrow::int32()),
+		arrow::field("x", arrow::float64()),
+		arrow::field("y", arrow::float64()),
+		arrow::field("w", arrow::float64()),
+		arrow::field("h", arrow::float64()),
+		arrow::field("ok", arrow::boolean())
+	};
+	if(opt.ANALYSIS) {
+		for(const char *name : KINEMATICS_NAMES) {
+			fields.push_back(arrow::field(name, arrow::float64()));
+		}
+	}
+	int first_filtered = (int)fields.size();
+	if(t.filtered()) {
+		for(const char *name : FILTERED_NAMES) {
+			fields.push_back(arrow::field(name, arrow::float64()));
+		}
+	}
+	std::vector<arrow::ArrayVector> chunks(fields.size());
+
+	// Frame numbers are the same for every droplet so all chunks share one array
+	std::shared_ptr<arrow::Buffer> frame_numbers;
+	ARROW_ASSIGN_OR_RAISE(frame_numbers, arrow::AllocateBuffer((int64_t)num_rows * sizeof(int32_t)));
+	std::iota((int32_t*)frame_numbers->mutable_data(), (int32_t*)frame_numbers->mutable_data() + num_rows, t.first_row);
+	std::shared_ptr<arrow::Array> frame_array = std::make_shared<arrow::Int32Array>(num_rows, frame_numbers);
+
+	for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+		std::shared_ptr<arrow::Buffer> droplet_numbers;
+		ARROW_ASSIGN_OR_RAISE(droplet_numbers, arrow::AllocateBuffer((int64_t)num_rows * sizeof(int32_t)));
+		std::fill((int32_t*)droplet_numbers->mutable_data(), (int32_t*)droplet_numbers->mutable_data() + num_rows, i);
+
+		chunks[0].push_back(frame_array);
+		chunks[1].push_back(std::make_shared<arrow::Int32Array>(num_rows, droplet_numbers));
+		chunks[2].push_back(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::X, i, num_rows)));
+		chunks[3].push_back(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::Y, i, num_rows)));
+		chunks[4].push_back(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::W, i, num_rows)));
+		chunks[5].push_back(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(Trajectories::H, i, num_rows)));
+		chunks[6].push_back(std::make_shared<arrow::BooleanArray>(num_rows, t.slice_ok(i, num_rows)));
+
+		// Store velocity, acceleration and force
+		if(opt.ANALYSIS) {
+			arrow::ArrayVector kinematic_columns;
+			ARROW_ASSIGN_OR_RAISE(kinematic_columns, kinematics(t, i, num_rows, opt));
+			for(int c = 0; c < 6; c++) {
+				chunks[7 + c].push_back(kinematic_columns[c]);
+			}
+		}
+
+		// Store filtered centre and velocity
+		if(t.filtered()) {
+			for(int c = 0; c < 4; c++) {
+				chunks[first_filtered + c].push_back(std::make_shared<arrow::DoubleArray>(num_rows, t.slice(FILTERED_QUANTITIES[c], i, num_rows)));
+			}
+		}
+	}
+	std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+	for(int c = 0; c < fields.size(); c++) {
+		columns.push_back(std::make_shared<arrow::ChunkedArray>(chunks[c], fields[c]->type()));
+	}
+
+	// Per-run values go into the file's key-value metadata instead of mostly-NULL columns
+	std::string diameters;
+	for(int i = 0; i < opt.DIAMETERS.size(); i++) {
+		diameters += (i == 0 ? "" : " ") + std::to_string(opt.DIAMETERS[i]);
+	}
+	std::shared_ptr<arrow::KeyValueMetadata> metadata = arrow::key_value_metadata(
+		{"DROPLETS", "DIAMETERS", "DENSITY", "FPS"},
+		{std::to_string(opt.NUM_DROPLETS), diameters, std::to_string(opt.DENSITY), std::to_string(opt.FPS)});
+
+	std::shared_ptr<arrow::Schema> schema = arrow::schema(fields, metadata);
+	return arrow::Table::Make(schema, columns, (int64_t)opt.NUM_DROPLETS * num_rows);
+}
+
+// Builds the output table selected with --long
+arrow::Result<std::shared_ptr<arrow::Table>> make_output(Trajectories &t, int num_rows, const Options &opt) {
+	if(opt.LONG) {
+		return make_long_table(t, num_rows, opt);
+	}
+	return make_table(t, num_rows, opt);
+}
+
+// Parquet writer properties selected with --row-group, --compression, --encoding and --no-statistics
+std::shared_ptr<parquet::WriterProperties> writer_properties(const arrow::Schema &schema, const Options &opt) {
+	parquet::WriterProperties::Builder builder;
+	builder.max_row_group_length(opt.ROW_GROUP_ROWS);
+	if(opt.COMPRESSION == "snappy") {
+		builder.compression(arrow::Compression::SNAPPY);
+	} else if(opt.COMPRESSION == "lz4") {
+		builder.compression(arrow::Compression::LZ4);
+	} else if(opt.COMPRESSION == "zstd") {
+		builder.compression(arrow::Compression::ZSTD);
+	}
+	if(!opt.STATISTICS) {
+		builder.disable_statistics();
+	}
+
+	// BYTE_STREAM_SPLIT only applies to floating point columns (and replaces their dictionary)
+	if(opt.ENCODING != "dictionary") {
+		for(const std::shared_ptr<arrow::Field> &field : schema.fields()) {
+			if(field->type()->id() == arrow::Type::DOUBLE) {
+				builder.disable_dictionary(field->name());
+				if(opt.ENCODING == "split") {
+					builder.encoding(field->name(), parquet::Encoding::BYTE_STREAM_SPLIT);
+				}
+			}
+		}
+	}
+	return builder.build();
+}
+
+// Writes the output to a parquet or Arrow IPC (feather) file, optionally one block of rows at a time while tracking proceeds
+class OutputWriter {
+public:
+	explicit OutputWriter(const Options &opt) : opt(opt) {}
+
+	// Opens filepath and writes the file header
+	arrow::Status open(std::string &filepath, Trajectories &t) {
+		std::shared_ptr<arrow::Table> empty;
+		ARROW_ASSIGN_OR_RAISE(empty, make_output(t, 0, opt));
+		ARROW_ASSIGN_OR_RAISE(outfile, arrow::io::FileOutputStream::Open(filepath));
+		if(opt.FORMAT == "parquet") {
+			ARROW_ASSIGN_OR_RAISE(parquet_writer, parquet::arrow::FileWriter::Open(*empty->schema(), arrow::default_memory_pool(), outfile, writer_properties(*empty->schema(), opt)));
+		} else {
+			// Uncompressed IPC files can be memory-mapped and read without deserializing
+			arrow::ipc::IpcWriteOptions options = arrow::ipc::IpcWriteOptions::Defaults();
+			if(opt.COMPRESSION == "lz4") {
+				ARROW_ASSIGN_OR_RAISE(options.codec, arrow::util::Codec::Create(arrow::Compression::LZ4_FRAME));
+			} else if(opt.COMPRESSION == "zstd") {
+				ARROW_ASSIGN_OR_RAISE(options.codec, arrow::util::Codec::Create(arrow::Compression::ZSTD));
+			}
+			ARROW_ASSIGN_OR_RAISE(ipc_writer, arrow::ipc::MakeFileWriter(outfile, empty->schema(), options));
+		}
+		return arrow::Status::OK();
+	}
+
+	// Appends table (as row groups or record batches of at most ROW_GROUP_ROWS rows)
+	arrow::Status write(const arrow::Table &table) {
+		if(parquet_writer) {
+			return parquet_writer->WriteTable(table, opt.ROW_GROUP_ROWS);
+		}
+		return ipc_writer->WriteTable(table, opt.ROW_GROUP_ROWS);
+	}
+
+	// Appends the first num_rows rows of t
+	arrow::Status write(Trajectories &t, int num_rows) {
+		std::shared_ptr<arrow::Table> table;
+		ARROW_ASSIGN_OR_RAISE(table, make_output(t, num_rows, opt));
+		return write(*table);
+	}
+
+	// Writes the frames of t up to num_rows that have not been written yet and the footer
+	arrow::Status close(Trajectories &t, int num_rows) {
+		if(t.first_row < num_rows) {
+			ARROW_RETURN_NOT_OK(write(t, num_rows - t.first_row));
+		}
+		return close();
+	}
+
+	// Writes the footer
+	arrow::Status close() {
+		if(parquet_writer) {
+			ARROW_RETURN_NOT_OK(parquet_writer->Close());
+		} else {
+			ARROW_RETURN_NOT_OK(ipc_writer->Close());
+		}
+		return outfile->Close();
+	}
+
+private:
+	const Options &opt;
+	std::shared_ptr<arrow::io::FileOutputStream> outfile;
+	std::unique_ptr<parquet::arrow::FileWriter> parquet_writer;
+	std::shared_ptr<arrow::ipc::RecordBatchWriter> ipc_writer;
+};
+
+// Writes --stream blocks as part files in a directory next to the output, each complete (footer included) as soon as its block
+// is tracked so a run that is killed keeps every block written before it; closing copies the parts into the output in order
+class PartWriter {
+public:
+	explicit PartWriter(const Options &opt) : opt(opt) {}
+
+	// Starts an empty FILEPATH.parts directory (removing parts of an earlier run)
+	arrow::Status open(const std::string &filepath) {
+		this->filepath = filepath;
+		directory = filepath + ".parts";
+		std::error_code error;
+		std::filesystem::remove_all(directory, error);
+		if(!std::filesystem::create_directory(directory, error)) {
+			return arrow::Status::IOError("could not create ", directory, ": ", error.message());
+		}
+		return arrow::Status::OK();
+	}
+
+	// Writes the first num_rows rows of t as the next part, then clears t to hold the following frames
+	arrow::Status flush(Trajectories &t, int num_rows) {
+		ARROW_RETURN_NOT_OK(write_part(t, t.first_row + num_rows));
+		t.advance(num_rows);
+		return arrow::Status::OK();
+	}
+
+	// Writes the frames of t up to num_rows that have not been written yet as the last part, copies every part into the output
+	// file and removes the parts
+	arrow::Status close(Trajectories &t, int num_rows) {
+		if(t.first_row < num_rows) {
+			ARROW_RETURN_NOT_OK(write_part(t, num_rows));
+		}
+		OutputWriter output(opt);
+		ARROW_RETURN_NOT_OK(output.open(filepath, t));
+		for(const std::string &part : parts) {
+			std::shared_ptr<arrow::io::ReadableFile> infile;
+			ARROW_ASSIGN_OR_RAISE(infile, arrow::io::ReadableFile::Open(part));
+			std::shared_ptr<arrow::Table> table;
+			if(opt.FORMAT == "parquet") {
+				std::unique_ptr<parquet::arrow::FileReader> reader;
+				ARROW_RETURN_NOT_OK(parquet::arrow::OpenFile(infile, arrow::default_memory_pool(), &reader));
+				for(int g = 0; g < reader->num_row_groups(); g++) {
+					ARROW_RETURN_NOT_OK(reader->ReadRowGroup(g, &table));
+					ARROW_RETURN_NOT_OK(output.write(*table));
+				}
+			} else {
+				std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader;
+				ARROW_ASSIGN_OR_RAISE(reader, arrow::ipc::RecordBatchFileReader::Open(infile.get()));
+				for(int b = 0; b < reader->num_record_batches(); b++) {
+					std::shared_ptr<arrow::RecordBatch> batch;
+					ARROW_ASSIGN_OR_RAISE(batch, reader->ReadRecordBatch(b));
+					ARROW_ASSIGN_OR_RAISE(table, arrow::Table::FromRecordBatches({batch}));
+					ARROW_RETURN_NOT_OK(output.write(*table));
+				}
+			}
+			ARROW_RETURN_NOT_OK(infile->Close());
+		}
+		ARROW_RETURN_NOT_OK(output.close());
+		std::error_code error;
+		std::filesystem::remove_all(directory, error);
+		return arrow::Status::OK();
+	}
+
+private:
+	// Writes the rows of t up to frame end as a part of its own
+	arrow::Status write_part(Trajectories &t, int end) {
+		char name[32];
+		std::snprintf(name, sizeof(name), "part-%05d", (int)parts.size());
+		std::string path = directory + "/" + name + std::filesystem::path(filepath).extension().string();
+		OutputWriter part(opt);
+		ARROW_RETURN_NOT_OK(part.open(path, t));
+		ARROW_RETURN_NOT_OK(part.close(t, end));
+		parts.push_back(path);
+		return arrow::Status::OK();
+	}
+
+	const Options &opt;
+	std::string filepath, directory;
+	std::vector<std::string> parts;
+};
+
+// Store data to the output file
+arrow::Status store_data(std::string &filepath, Trajectories &t, const Options &opt) {
+	OutputWriter writer(opt);
+	ARROW_RETURN_NOT_OK(writer.open(filepath, t));
+	return writer.close(t, opt.NUM_FRAMES);
+}
+
+// Finds bboxes of count droplets on frame whose diameters (in pixels) best match px_diameters (fewer if not all are found)
+// Each blob goes to the DIAMETERS value it is closest to, and droplets with that value are numbered left to right
+std::vector<cv::Rect> detect_droplets(const cv::Mat &frame, const std::vector<double> &px_diameters, int count) {
+	cv::Mat gray, mask;
+	if(frame.channels() == 1) {
+		gray = frame;
+	} else {
+		cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+	}
+	cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+
+	// Collect blobs of either polarity (droplets may be darker or brighter than the background)
+	std::vector<cv::Rect> candidates;
+	std::vector<double> candidate_diameters;
+	for(int type : {cv::THRESH_BINARY, cv::THRESH_BINARY_INV}) {
+		cv::threshold(gray, mask, 0, 255, type | cv::THRESH_OTSU);
+		std::vector<std::vector<cv::Point>> contours;
+		cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+		for(const std::vector<cv::Point> &contour : contours) {
+			cv::Point2f centre;
+			float radius;
+			cv::minEnclosingCircle(contour, centre, radius);
+
+			// Skip blobs that are far from round or touch the frame border
+			cv::Rect bbox = cv::boundingRect(contour);
+			if(cv::contourArea(contour) < 0.5 * CV_PI * radius * radius || bbox.x == 0 || bbox.y == 0
+				|| bbox.br().x >= frame.cols || bbox.br().y >= frame.rows) {
+				continue;
+			}
+
+			// Skip duplicates found with the other polarity
+			bool duplicate = false;
+			for(const cv::Rect &other : candidates) {
+				if((bbox & other).area() > 0.5 * std::min(bbox.area(), other.area())) {
+					duplicate = true;
+					break;
+				}
+			}
+			if(!duplicate) {
+				candidates.push_back(bbox);
+				candidate_diameters.push_back(2.0 * radius);
+			}
+		}
+	}
+
+	// Order candidates left to right
+	std::vector<int> order(candidates.size());
+	for(int k = 0; k < order.size(); k++) {
+		order[k] = k;
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return candidates[a].x < candidates[b].x; });
+
+	// Diameter each candidate is closest to (NAN if none is within 30%)
+	std::vector<double> nearest(candidates.size(), NAN);
+	for(int k = 0; k < candidates.size(); k++) {
+		double best_error = 0.3;
+		for(double diameter : px_diameters) {
+			double error = std::abs(candidate_diameters[k] - diameter) / diameter;
+			if(error < best_error) {
+				nearest[k] = diameter;
+				best_error = error;
+			}
+		}
+	}
+
+	// Assign each droplet the leftmost unused candidate closest to its diameter
+	std::vector<cv::Rect> bboxes;
+	std::vector<bool> used(candidates.size(), false);
+	for(int i = 0; i < count; i++) {
+		double diameter = px_diameters[std::min(i, (int)px_diameters.size() - 1)];
+		int best = -1;
+		for(int k : order) {
+			if(!used[k] && nearest[k] == diameter) {
+				best = k;
+				break;
+			}
+		}
+		if(best == -1) {
+			break;
+		}
+		used[best] = true;
+		bboxes.push_back(candidates[best]);
+	}
+	return bboxes;
+}
+
+// Looks for a lost droplet of the given diameter (px) around its last good bbox, padded by the diameter once more for every
+// frame it has been lost, taking the blob closest to that bbox that does not sit on another droplet's bbox (empty if none found)
+cv::Rect redetect(const cv::Mat &frame, const cv::Rect &last, double diameter, int frames_lost, const std::vector<cv::Rect> &others) {
+	int pad = (int)std::ceil(diameter * (1 + frames_lost));
+	cv::Rect window = cv::Rect(last.x - pad, last.y - pad, last.width + 2 * pad, last.height + 2 * pad) & cv::Rect(0, 0, frame.cols, frame.rows);
+	cv::Rect best;
+	double best_distance = DBL_MAX;
+	for(cv::Rect bbox : detect_droplets(frame(window), {diameter}, INT_MAX)) {
+		bbox += window.tl();
+		bool taken = false;
+		for(const cv::Rect &other : others) {
+			if((bbox & other).area() > 0.5 * bbox.area()) {
+				taken = true;
+				break;
+			}
+		}
+		double distance = cv::norm((bbox.tl() + bbox.br()) - (last.tl() + last.br()));
+		if(!taken && distance < best_distance) {
+			best = bbox;
+			best_distance = distance;
+		}
+	}
+	return best;
+}
+
+// Tracks a high-contrast droplet by the intensity-weighted centroid of a thresholded window around its last bbox
+class CentroidTracker : public cv::Tracker {
+public:
+	static cv::Ptr<CentroidTracker> create() {
+		return cv::makePtr<CentroidTracker>();
+	}
+
+	void init(cv::InputArray image, const cv::Rect &boundingBox) override {
+		bbox = boundingBox;
+		cv::Mat window = search_window(image.getMat());
+
+		// Threshold and polarity are fixed from the first frame (droplet brighter or darker than its surroundings)
+		cv::Mat mask;
+		threshold = cv::threshold(window, mask, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+		cv::Rect inner = (bbox - window_origin) & cv::Rect(0, 0, window.cols, window.rows);
+		dark = cv::mean(window(inner))[0] < cv::mean(window)[0];
+		if(dark) {
+			threshold = 255 - threshold;
+		}
+	}
+
+	bool update(cv::InputArray image, cv::Rect &boundingBox) override {
+		cv::Mat window = search_window(image.getMat());
+		if(dark) {
+			cv::bitwise_not(window, window);
+		}
+		cv::threshold(window, window, threshold, 0, cv::THRESH_TOZERO);
+		cv::Moments m = cv::moments(window);
+		if(m.m00 <= 0) {
+			return false;
+		}
+
+		// Recentre the bbox on the centroid
+		bbox.x = window_origin.x + (int)std::lround(m.m10 / m.m00 - bbox.width / 2.0);
+		bbox.y = window_origin.y + (int)std::lround(m.m01 / m.m00 - bbox.height / 2.0);
+		boundingBox = bbox;
+		return true;
+	}
+
+private:
+	// Grayscale copy of the last bbox padded by half its size on each side, clipped to the frame
+	cv::Mat search_window(const cv::Mat &frame) {
+		cv::Rect window = cv::Rect(bbox.x - bbox.width / 2, bbox.y - bbox.height / 2, 2 * bbox.width, 2 * bbox.height) & cv::Rect(0, 0, frame.cols, frame.rows);
+		window_origin = window.tl();
+		cv::Mat gray;
+		if(frame.channels() == 1) {
+			frame(window).copyTo(gray);
+		} else {
+			cv::cvtColor(frame(window), gray, cv::COLOR_BGR2GRAY);
+		}
+		return gray;
+	}
+
+	cv::Rect bbox;
+	cv::Point window_origin;
+	double threshold = 0.0;
+	bool dark = false;
+};
+
+// Feature planes (gray level and gradient magnitude) of the image trackers are given, computed once per frame and sampled by
+// every --tracker shared instance, so the per-frame feature cost does not grow with the number of droplets
+class SharedFeatures {
+public:
+	// Computes the planes of frame (called once per frame before any tracker sees it)
+	void compute(const cv::Mat &frame) {
+		cv::Size whole;
+		frame.locateROI(whole, origin);
+		if(frame.channels() == 1) {
+			frame.convertTo(gray, CV_32F, 1.0 / 255);
+		} else {
+			cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+			gray.convertTo(gray, CV_32F, 1.0 / 255);
+		}
+		cv::Sobel(gray, dx, CV_32F, 1, 0);
+		cv::Sobel(gray, dy, CV_32F, 0, 1);
+		cv::magnitude(dx, dy, dx);
+		cv::merge(std::vector<cv::Mat>{gray, dx}, planes);
+	}
+
+	// Planes under image, the frame given to compute or a region of it
+	cv::Mat under(const cv::Mat &image) const {
+		cv::Size whole;
+		cv::Point at;
+		image.locateROI(whole, at);
+		return planes(cv::Rect(at - origin, image.size()));
+	}
+
+private:
+	cv::Mat gray, dx, dy, planes;
+	cv::Point origin;
+};
+
+// Tracks a droplet by normalized cross-correlation of its template against the shared feature planes around its last bbox
+class SharedFeatureTracker : public cv::Tracker {
+public:
+	// Lowest correlation accepted as the droplet and the rate the template follows its appearance
+	static constexpr double MIN_SCORE = 0.5, LEARNING_RATE = 0.05;
+
+	explicit SharedFeatureTracker(const SharedFeatures &features) : features(features) {}
+
+	static cv::Ptr<SharedFeatureTracker> create(const SharedFeatures &features) {
+		return cv::makePtr<SharedFeatureTracker>(features);
+	}
+
+	void init(cv::InputArray image, const cv::Rect &boundingBox) override {
+		cv::Mat planes = features.under(image.getMat());
+		bbox = clamp(boundingBox, planes.size());
+		planes(bbox).copyTo(templ);
+	}
+
+	bool update(cv::InputArray image, cv::Rect &boundingBox) override {
+		cv::Mat planes = features.under(image.getMat());
+		bbox = clamp(bbox, planes.size());
+
+		// Search a window twice the bbox around its last position
+		cv::Rect search = cv::Rect(bbox.x - bbox.width / 2, bbox.y - bbox.height / 2, 2 * bbox.width, 2 * bbox.height) & cv::Rect(cv::Point(0, 0), planes.size());
+		if(templ.empty() || search.width < templ.cols || search.height < templ.rows) {
+			return false;
+		}
+		cv::Mat score;
+		cv::matchTemplate(planes(search), templ, score, cv::TM_CCOEFF_NORMED);
+		double best;
+		cv::Point at;
+		cv::minMaxLoc(score, NULL, &best, NULL, &at);
+		if(best < MIN_SCORE) {
+			return false;
+		}
+		bbox.x = search.x + at.x;
+		bbox.y = search.y + at.y;
+		cv::accumulateWeighted(planes(bbox), templ, LEARNING_RATE);
+		boundingBox = bbox;
+		return true;
+	}
+
+private:
+	// Moves r inside size, keeping its size (the template size)
+	static cv::Rect clamp(cv::Rect r, const cv::Size &size) {
+		r.width = std::min(r.width, size.width);
+		r.height = std::min(r.height, size.height);
+		r.x = std::clamp(r.x, 0, size.width - r.width);
+		r.y = std::clamp(r.y, 0, size.height - r.height);
+		return r;
+	}
+
+	const SharedFeatures &features;
+	cv::Rect bbox;
+	cv::Mat templ;
+};
+
+// Builds the CSRT parameters for --profile, overridden by any fields set in --params
+int csrt_params(cv::TrackerCSRT::Params &params, const Options &opt) {
+	// accurate keeps the OpenCV defaults (HOG, colour names, segmentation, 33 scales, 4 ADMM iterations)
+	if(opt.PROFILE == "balanced") {
+		params.use_color_names = false;
+		params.number_of_scales = 17;
+		params.admm_iterations = 3;
+		params.template_size = 150;
+	} else if(opt.PROFILE == "fast") {
+		params.use_hog = false;
+		params.use_color_names = false;
+		params.use_gray = true;
+		params.use_segmentation = false;
+		params.number_of_scales = 9;
+		params.admm_iterations = 2;
+		params.template_size = 100;
+	}
+
+	// A search centred on the predicted position needs less room around the droplet (OpenCV default 3)
+	if(opt.KALMAN) {
+		params.padding = 2.0f;
+	}
+	if(opt.PARAMS_PATH.compare("") == 0) {
+		return 0;
+	}
+
+	cv::FileStorage fs;
+	try {
+		fs.open(opt.PARAMS_PATH, cv::FileStorage::READ);
+	} catch(const cv::Exception &e) {
+		std::cerr << e.what() << std::endl;
+	}
+	if(!fs.isOpened()) {
+		std::cerr << "could not read CSRT parameters from " << opt.PARAMS_PATH << std::endl;
+		return 1;
+	}
+	cv::FileNode root = fs.root();
+	auto read_bool = [&](const char *name, bool &value) {
+		if(!root[name].empty()) {
+			value = (int)root[name] != 0;
+		}
+	};
+	auto read_int = [&](const char *name, int &value) {
+		if(!root[name].empty()) {
+			value = (int)root[name];
+		}
+	};
+	auto read_float = [&](const char *name, float &value) {
+		if(!root[name].empty()) {
+			value = (float)root[name];
+		}
+	};
+	read_bool("use_hog", params.use_hog);
+	read_bool("use_color_names", params.use_color_names);
+	read_bool("use_gray", params.use_gray);
+	read_bool("use_rgb", params.use_rgb);
+	read_bool("use_channel_weights", params.use_channel_weights);
+	read_bool("use_segmentation", params.use_segmentation);
+	if(!root["window_function"].empty()) {
+		params.window_function = (std::string)root["window_function"];
+	}
+	read_float("kaiser_alpha", params.kaiser_alpha);
+	read_float("cheb_attenuation", params.cheb_attenuation);
+	read_float("template_size", params.template_size);
+	read_float("gsl_sigma", params.gsl_sigma);
+	read_float("hog_orientations", params.hog_orientations);
+	read_float("hog_clip", params.hog_clip);
+	read_float("padding", params.padding);
+	read_float("filter_lr", params.filter_lr);
+	read_float("weights_lr", params.weights_lr);
+	read_int("num_hog_channels_used", params.num_hog_channels_used);
+	read_int("admm_iterations", params.admm_iterations);
+	read_int("histogram_bins", params.histogram_bins);
+	read_float("histogram_lr", params.histogram_lr);
+	read_int("background_ratio", params.background_ratio);
+	read_int("number_of_scales", params.number_of_scales);
+	read_float("scale_sigma_factor", params.scale_sigma_factor);
+	read_float("scale_model_max_area", params.scale_model_max_area);
+	read_float("scale_lr", params.scale_lr);
+	read_float("scale_step", params.scale_step);
+	read_float("psr_threshold", params.psr_threshold);
+	return 0;
+}
+
+// Creates a tracker of the given --tracker type
+cv::Ptr<cv::Tracker> create_tracker(const std::string &tracker, const cv::TrackerCSRT::Params &params, const SharedFeatures &features) {
+	if(tracker == "shared") {
+		return SharedFeatureTracker::create(features);
+	} else if(tracker == "kcf") {
+		return cv::TrackerKCF::create();
+	} else if(tracker == "mosse") {
+		return cv::legacy::upgradeTrackingAPI(cv::legacy::TrackerMOSSE::create());
+	} else if(tracker == "centroid") {
+		return CentroidTracker::create();
+	}
+	return cv::TrackerCSRT::create(params);
+}
+
+// Constant-velocity Kalman filter of a droplet's centre that moves its tracker's search onto the predicted position
+// Trackers search around their last bbox in the image they are given, so handing them a region of the frame shifted by the
+// predicted motion centres the search on the prediction; the region is a few bboxes wide, clipped to the frame
+class Predictor {
+public:
+	// Region size in bboxes (covers the reduced CSRT padding with room for scale changes)
+	static constexpr int REGION_SCALE = 4;
+
+	Predictor() : kf(4, 2, 0, CV_64F) {
+		// State (x, y, vx, vy) in px and px/frame, measured (x, y)
+		kf.transitionMatrix = (cv::Mat_<double>(4, 4) << 1, 0, 1, 0, 0, 1, 0, 1, 0, 0, 1, 0, 0, 0, 0, 1);
+		cv::setIdentity(kf.measurementMatrix);
+		cv::setIdentity(kf.processNoiseCov, cv::Scalar::all(1e-2));
+		cv::setIdentity(kf.measurementNoiseCov, cv::Scalar::all(1.0));
+	}
+
+	// Starts filtering at bbox (coordinates of a frame of frame_size) and returns the region the tracker is initialized on
+	cv::Rect init(const cv::Rect &bbox, const cv::Size &frame_size) {
+		bounds = cv::Rect(cv::Point(0, 0), frame_size);
+		region = cv::Rect(0, 0, std::min(frame_size.width, REGION_SCALE * bbox.width), std::min(frame_size.height, REGION_SCALE * bbox.height));
+		last = centre(bbox);
+		place(last);
+		kf.statePost = (cv::Mat_<double>(4, 1) << last.x, last.y, 0, 0);
+		cv::setIdentity(kf.errorCovPost, cv::Scalar::all(1.0));
+		kf.errorCovPost.at<double>(2, 2) = kf.errorCovPost.at<double>(3, 3) = 10.0;
+		return region;
+	}
+
+	// Predicts the next frame and returns the region, moved by the predicted motion, to update the tracker on
+	cv::Rect predict() {
+		const cv::Mat &state = kf.predict();
+		cv::Point2d motion = cv::Point2d(state.at<double>(0), state.at<double>(1)) - last;
+		cv::Point before = region.tl();
+		place(centre(region) + motion);
+
+		// Where the tracker will search, now that its image moved
+		last += cv::Point2d(region.tl() - before);
+		return region;
+	}
+
+	// Corrects the filter with the tracked bbox (frame coordinates), keeping the prediction if tracking failed
+	void correct(const cv::Rect &bbox, bool ok) {
+		if(ok) {
+			last = centre(bbox);
+			kf.correct((cv::Mat_<double>(2, 1) << last.x, last.y));
+		}
+	}
+
+	cv::Point2d position() const { return cv::Point2d(kf.statePost.at<double>(0), kf.statePost.at<double>(1)); }
+	cv::Point2d velocity() const { return cv::Point2d(kf.statePost.at<double>(2), kf.statePost.at<double>(3)); }
+
+private:
+	static cv::Point2d centre(const cv::Rect &r) { return cv::Point2d(r.x + r.width / 2.0, r.y + r.height / 2.0); }
+
+	// Centres the region on p, kept inside the frame
+	void place(const cv::Point2d &p) {
+		region.x = std::clamp((int)std::lround(p.x - region.width / 2.0), 0, bounds.width - region.width);
+		region.y = std::clamp((int)std::lround(p.y - region.height / 2.0), 0, bounds.height - region.height);
+	}
+
+	cv::KalmanFilter kf;
+	cv::Rect bounds, region;
+	cv::Point2d last;
+};
+
+// Running histogram of durations in microseconds, kept in fixed log-linear buckets (SUBBUCKETS per power of two) so recording
+// never allocates and percentiles come out within 1 / SUBBUCKETS of the exact value
+class Histogram {
+public:
+	static const int SUBBUCKETS = 8, OCTAVES = 40;
+
+	void add(double us) {
+		count++;
+		total += us;
+		slowest = std::max(slowest, us);
+		buckets[bucket(us)]++;
+	}
+
+	long calls() const { return count; }
+	double mean() const { return count > 0 ? total / count : 0.0; }
+	double max() const { return slowest; }
+
+	// Value p percent of samples are at or below (nearest rank), rounded up to its bucket's upper edge
+	double percentile(double p) const {
+		long rank = std::max(1L, (long)std::ceil(p / 100.0 * count));
+		long seen = 0;
+		for(int b = 0; b < SUBBUCKETS * OCTAVES; b++) {
+			seen += buckets[b];
+			if(seen >= rank) {
+				return std::min(slowest, std::ldexp(1.0 + (b % SUBBUCKETS + 1.0) / SUBBUCKETS, b / SUBBUCKETS));
+			}
+		}
+		return slowest;
+	}
+
+	// Displays the calls per power-of-two microsecond bucket (1-2 us also holds the calls under 1 us)
+	void print() const {
+		long octaves[OCTAVES] = {0};
+		for(int b = 0; b < SUBBUCKETS * OCTAVES; b++) {
+			octaves[b / SUBBUCKETS] += buckets[b];
+		}
+		long widest = *std::max_element(octaves, octaves + OCTAVES);
+		for(int k = 0; k < OCTAVES; k++) {
+			if(octaves[k] > 0) {
+				std::cout << "\t" << (1L << k) << "-" << (2L << k) << " us\t" << std::string((size_t)std::ceil(40.0 * octaves[k] / widest), '#')
+					<< " " << octaves[k] << std::endl;
+			}
+		}
+	}
+
+private:
+	static int bucket(double us) {
+		if(us < 1.0) {
+			return 0;
+		}
+		int k = std::min(OCTAVES - 1, std::ilogb(us));
+		int sub = std::min(SUBBUCKETS - 1, (int)((std::ldexp(us, -k) - 1.0) * SUBBUCKETS));
+		return k * SUBBUCKETS + sub;
+	}
+
+	long count = 0;
+	double total = 0.0, slowest = 0.0;
+	long buckets[SUBBUCKETS * OCTAVES] = {0};
+};
+
+// Times every call of each tracking loop stage into a running histogram per stage for the -t summary
+// With --trace FILE every call is also written to FILE as a Chrome trace event, TRACE_BUFFER events at a time
+class Profiler {
+public:
+	enum Stage {DECODE, EXTRACT, UPDATE, RESULTS, DISPLAY, PROGRESS, STORE, NUM_STAGES};
+
+	// Trace events held before they are written out
+	static const int TRACE_BUFFER = 4096;
+
+	// trace_path is empty without --trace
+	Profiler(bool timeit, const std::string &trace_path) : enabled(timeit || trace_path.compare("") != 0), origin(std::chrono::steady_clock::now()),
+		threads(1, std::this_thread::get_id()) {
+		if(trace_path.compare("") != 0) {
+			trace.open(trace_path);
+			trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::fixed << std::setprecision(3);
+			pending.reserve(TRACE_BUFFER);
+		}
+	}
+
+	// Whether the --trace file is open for writing
+	bool tracing() const { return trace.is_open(); }
+
+	// Records a call of stage that began at start (frame and droplet label the trace event, -1 if none)
+	void record(Stage stage, std::chrono::steady_clock::time_point start, int frame, int droplet = -1) {
+		if(!enabled) {
+			return;
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		double us = std::chrono::duration<double, std::micro>(end - start).count();
+		std::lock_guard<std::mutex> lock(mtx);
+		stages[stage].add(us);
+		if(!trace.is_open()) {
+			return;
+		}
+		int tid = (int)(std::find(threads.begin(), threads.end(), std::this_thread::get_id()) - threads.begin());
+		if(tid == threads.size()) {
+			threads.push_back(std::this_thread::get_id());
+		}
+		pending.push_back({stage, std::chrono::duration<double, std::micro>(start - origin).count(), us, frame, droplet, tid});
+		if(pending.size() == TRACE_BUFFER) {
+			flush();
+		}
+	}
+
+	// Displays count, mean, percentiles and a power-of-two histogram of every stage that ran
+	void report() {
+		for(int s = 0; s < NUM_STAGES; s++) {
+			const Histogram &h = stages[s];
+			if(h.calls() == 0) {
+				continue;
+			}
+			std::cout << "Stage " << NAMES[s] << ": " << h.calls() << " calls, " << h.mean() / 1000.0 << " ms avg, " << h.percentile(50) / 1000.0 << " / "
+				<< h.percentile(95) / 1000.0 << " / " << h.percentile(99) / 1000.0 << " ms (p50 / p95 / p99), " << h.max() / 1000.0 << " ms max" << std::endl;
+			h.print();
+		}
+	}
+
+	// Writes the trace events still buffered and closes the --trace file, viewable in chrome://tracing or Perfetto
+	int close_trace() {
+		flush();
+		trace << "\n]}" << std::endl;
+		trace.close();
+		return trace.good() ? 0 : 1;
+	}
+
+private:
+	struct Event {
+		Stage stage;
+		double start, us;
+		int frame, droplet, tid;
+	};
+	static constexpr const char *NAMES[NUM_STAGES] = {"decode", "features", "update", "results", "display", "progress", "store"};
+
+	// Writes the buffered events as complete ('X') trace events
+	void flush() {
+		for(const Event &e : pending) {
+			trace << (first ? "\n" : ",\n") << "{\"name\":\"" << NAMES[e.stage] << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.tid
+				<< ",\"ts\":" << e.start << ",\"dur\":" << e.us << ",\"args\":{";
+			if(e.frame >= 0) {
+				trace << "\"frame\":" << e.frame << (e.droplet >= 0 ? "," : "");
+			}
+			if(e.droplet >= 0) {
+				trace << "\"droplet\":" << e.droplet + 1;
+			}
+			trace << "}}";
+			first = false;
+		}
+		pending.clear();
+	}
+
+	const bool enabled;
+	std::chrono::steady_clock::time_point origin;
+	std::vector<std::thread::id> threads;
+	Histogram stages[NUM_STAGES];
+	std::ofstream trace;
+	std::vector<Event> pending;
+	bool first = true;
+	std::mutex mtx;
+};
+
+// Shows the latest tracked frame while tracking runs on another thread, so -s never holds up tracking (frames posted while
+// the display is busy are skipped)
+// HighGUI is not safe off the main thread on every backend (Cocoa aborts), so run() is called on the main thread
+class Display {
+public:
+	// window is outlined when cropping (empty otherwise)
+	Display(const cv::Rect &window, Profiler &profiler) : window(window), profiler(profiler) {}
+
+	// Lets run() return once it has shown the frame still waiting, if any (called by the tracking thread when it is done)
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			done = true;
+		}
+		ready_cv.notify_one();
+	}
+
+	// Replaces the frame waiting to be shown (kept by reference, so the caller must decode the next frame into a new buffer)
+	void post(const cv::Mat &frame, int j, const std::vector<cv::Rect> &bboxes, const std::vector<char> &oks) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if(fresh) {
+				skipped++;
+			}
+			next = frame;
+			next_frame = j;
+			next_bboxes = bboxes;
+			next_oks = oks;
+			fresh = true;
+		}
+		ready_cv.notify_one();
+	}
+
+	// Draws and shows posted frames until close(), then closes the window
+	// The window keeps handling events (and ESC) between frames
+	void run() {
+		cv::Mat frame;
+		std::vector<cv::Rect> bboxes;
+		std::vector<char> oks;
+		while(true) {
+			int j;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				if(!ready_cv.wait_for(lock, std::chrono::milliseconds(30), [this] { return fresh || done; })) {
+					lock.unlock();
+					pump();
+					continue;
+				}
+				if(!fresh) {
+					break;
+				}
+				frame = next;
+				next.release();
+				j = next_frame;
+				bboxes.swap(next_bboxes);
+				oks.swap(next_oks);
+				fresh = false;
+			}
+
+			// Draw bboxes of tracked droplets and the analysis window on a copy (the frame may also be queued for --overlay-out)
+			std::chrono::steady_clock::time_point display_start = std::chrono::steady_clock::now();
+			cv::Mat canvas = frame.clone();
+			for(int i = 0; i < bboxes.size(); i++) {
+				if(oks[i]) {
+					cv::rectangle(canvas, bboxes[i], cv::Scalar(255, 0, 0), 2, 1);
+				}
+			}
+			if(!window.empty()) {
+				cv::rectangle(canvas, window, cv::Scalar(0, 255, 0), 1);
+			}
+			cv::imshow("Tracking", canvas);
+			pump();
+			shown++;
+			profiler.record(Profiler::DISPLAY, display_start, j);
+		}
+		if(shown > 0) {
+			cv::destroyWindow("Tracking");
+		}
+	}
+
+	// True once ESC was pressed in the window
+	bool closed() const { return escaped; }
+
+	std::atomic<long> shown{0}, skipped{0};
+
+private:
+	// Handles window events, noting ESC
+	void pump() {
+		if(shown > 0 && cv::waitKey(1) == 27) {
+			escaped = true;
+		}
+	}
+
+	cv::Rect window;
+	Profiler &profiler;
+	cv::Mat next;
+	int next_frame = 0;
+	std::vector<cv::Rect> next_bboxes;
+	std::vector<char> next_oks;
+	bool fresh = false, done = false;
+	std::atomic<bool> escaped{false};
+	std::mutex mtx;
+	std::condition_variable ready_cv;
+};
+
+// Draws droplet bboxes and numbers on queued frames and encodes them with cv::VideoWriter on its own thread
+class OverlayWriter {
+public:
+	// Frames waiting to be encoded before push blocks
+	static const int QUEUE_DEPTH = 8;
+
+	~OverlayWriter() {
+		close();
+	}
+
+	// Opens path for frames of the given size (scaled by scale) at fps, window is outlined when cropping (empty otherwise)
+	int open(const std::string &path, double fps, const cv::Size &size, double scale, const cv::Rect &window) {
+		std::string extension = std::filesystem::path(path).extension().string();
+		int fourcc = extension == ".avi" ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G') : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+		scaled = cv::Size((int)std::lround(size.width * scale), (int)std::lround(size.height * scale));
+		if(!writer.open(path, fourcc, fps > 0 ? fps : 30.0, scaled)) {
+			std::cerr << "could not open " << path << " for writing" << std::endl;
+			return 1;
+		}
+		this->window = window;
+		encoder = std::thread(&OverlayWriter::encode, this);
+		return 0;
+	}
+
+	// Queues frame j (kept by reference, so the caller must decode the next frame into a new buffer), waiting while the queue is full
+	void push(const cv::Mat &frame, int j, const std::vector<cv::Rect> &bboxes, const std::vector<char> &oks) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if(queue.size() == QUEUE_DEPTH) {
+				producer_stalls++;
+				space_cv.wait(lock, [this] { return queue.size() < QUEUE_DEPTH; });
+			}
+			queue.push_back({frame, j, bboxes, oks});
+		}
+		data_cv.notify_one();
+	}
+
+	// Encodes the frames still queued and finishes the file
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			done = true;
+		}
+		data_cv.notify_one();
+		if(encoder.joinable()) {
+			encoder.join();
+		}
+		writer.release();
+	}
+
+	long written = 0, producer_stalls = 0;
+
+private:
+	struct Item {
+		cv::Mat frame;
+		int j;
+		std::vector<cv::Rect> bboxes;
+		std::vector<char> oks;
+	};
+
+	void encode() {
+		cv::Mat canvas;
+		while(true) {
+			Item item;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				data_cv.wait(lock, [this] { return !queue.empty() || done; });
+				if(queue.empty()) {
+					break;
+				}
+				item = std::move(queue.front());
+				queue.pop_front();
+			}
+			space_cv.notify_one();
+
+			// Scale first so boxes and labels keep their thickness at any size
+			if(scaled == item.frame.size()) {
+				item.frame.copyTo(canvas);
+			} else {
+				cv::resize(item.frame, canvas, scaled, 0, 0, cv::INTER_AREA);
+			}
+			double sx = (double)scaled.width / item.frame.cols, sy = (double)scaled.height / item.frame.rows;
+			auto scale = [&](const cv::Rect &r) {
+				return cv::Rect((int)(r.x * sx), (int)(r.y * sy), (int)(r.width * sx), (int)(r.height * sy));
+			};
+			if(!window.empty()) {
+				cv::rectangle(canvas, scale(window), cv::Scalar(0, 255, 0), 1);
+			}
+			for(int i = 0; i < item.bboxes.size(); i++) {
+				if(item.oks[i]) {
+					cv::Rect bbox = scale(item.bboxes[i]);
+					cv::rectangle(canvas, bbox, cv::Scalar(255, 0, 0), 2, 1);
+					cv::putText(canvas, std::to_string(i + 1), bbox.tl() + cv::Point(0, -4), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 0, 0), 1);
+				}
+			}
+			cv::putText(canvas, std::to_string(item.j), cv::Point(4, 16), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 255), 1);
+			writer.write(canvas);
+			written++;
+		}
+	}
+
+	cv::VideoWriter writer;
+	cv::Size scaled;
+	cv::Rect window;
+	std::deque<Item> queue;
+	bool done = false;
+	std::mutex mtx;
+	std::condition_variable data_cv, space_cv;
+	std::thread encoder;
+};
+
+// Get most significant bit
+int getMSB(int val) {
+	if(val == 0) {
+		return 0;
+	}
+	int msb = 0;
+	val = val / 2;
+	while(val != 0) {
+		val = val / 2;
+		msb++;
+	}
+	return (1 << msb);
+}
+
+// Saves the tracking state every CHECKPOINT_FRAMES frames so an interrupted run can be continued with --resume
+// path holds the state after the last checkpointed frame and path.bin the bboxes of every frame up to it
+class Checkpoint {
+public:
+	Checkpoint(const std::string &path, int num_droplets) : path(path), num_droplets(num_droplets) {}
+
+	// Removes any checkpoint left by an earlier run
+	void reset() {
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+		std::ofstream(path + ".bin", std::ios::binary | std::ios::trunc);
+	}
+
+	// Loads the last checkpoint and the bboxes of every frame up to it (5 values per droplet and frame, see record)
+	int load(int &frame, cv::Rect &window, std::vector<cv::Rect> &bboxes, std::vector<int> &start_frames, std::vector<int> &lost_since,
+		std::vector<int32_t> &history) {
+		cv::FileStorage fs;
+		try {
+			fs.open(path, cv::FileStorage::READ);
+		} catch(const cv::Exception &e) {
+			std::cerr << e.what() << std::endl;
+		}
+		if(!fs.isOpened()) {
+			std::cerr << "no checkpoint to resume from (" << path << ")" << std::endl;
+			return 1;
+		}
+		int droplets = 0;
+		fs["droplets"] >> droplets;
+		fs["frame"] >> frame;
+		fs["window"] >> window;
+		fs["bboxes"] >> bboxes;
+		fs["start_frames"] >> start_frames;
+		fs["lost_since"] >> lost_since;
+		if(lost_since.size() != start_frames.size()) {
+			// Saved before lost droplets were recorded
+			lost_since.assign(start_frames.size(), -1);
+		}
+		if(droplets != num_droplets || bboxes.size() != num_droplets || start_frames.size() != num_droplets) {
+			std::cerr << path << " was saved for " << droplets << " droplets but -n DROPLETS is " << num_droplets << std::endl;
+			return 1;
+		}
+
+		history.resize((size_t)(frame + 1) * num_droplets * 5);
+		std::ifstream bin(path + ".bin", std::ios::binary);
+		if(!bin.read((char*)history.data(), history.size() * sizeof(int32_t))) {
+			std::cerr << path << ".bin is missing frames up to " << frame << std::endl;
+			return 1;
+		}
+		bin.close();
+
+		// Drop frames recorded after the checkpoint
+		std::error_code ec;
+		std::filesystem::resize_file(path + ".bin", history.size() * sizeof(int32_t), ec);
+		return 0;
+	}
+
+	// Records the bboxes of the next frame (stored[i] false if droplet i has no position on it)
+	void record(const std::vector<cv::Rect> &bboxes, const std::vector<char> &stored) {
+		for(int i = 0; i < bboxes.size(); i++) {
+			pending.insert(pending.end(), {bboxes[i].x, bboxes[i].y, bboxes[i].width, bboxes[i].height, stored[i]});
+		}
+	}
+
+	// Appends the recorded frames to path.bin, then atomically replaces path with the state after frame
+	bool save(int frame, const cv::Rect &window, const std::vector<cv::Rect> &bboxes, const std::vector<int> &start_frames, const std::vector<int> &lost_since) {
+		std::ofstream bin(path + ".bin", std::ios::binary | std::ios::app);
+		bin.write((const char*)pending.data(), pending.size() * sizeof(int32_t));
+		bin.flush();
+		if(!bin) {
+			return false;
+		}
+		pending.clear();
+
+		cv::FileStorage fs(path + ".tmp", cv::FileStorage::WRITE | cv::FileStorage::FORMAT_YAML);
+		fs << "droplets" << num_droplets << "frame" << frame << "window" << window << "bboxes" << bboxes << "start_frames" << start_frames << "lost_since" << lost_since;
+		fs.release();
+		std::error_code ec;
+		std::filesystem::rename(path + ".tmp", path, ec);
+		return !ec;
+	}
+
+	// Deletes the checkpoint once the output is complete
+	void remove() {
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+		std::filesystem::remove(path + ".bin", ec);
+	}
+
+private:
+	std::string path;
+	int num_droplets;
+	std::vector<int32_t> pending;
+};
+
+// Persistent pool of worker threads that runs a batch of independent tasks and waits for all of them
+class WorkerPool {
+public:
+	// A pool of one thread runs tasks on the calling thread instead
+	explicit WorkerPool(int num_threads) {
+		if(num_threads > 1) {
+			for(int t = 0; t < num_threads; t++) {
+				workers.emplace_back(&WorkerPool::work, this);
+			}
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		start_cv.notify_all();
+		for(std::thread &worker : workers) {
+			worker.join();
+		}
+	}
+
+	// Calls task(0) ... task(count - 1) across the workers and returns once all calls have finished
+	void run(int count, const std::function<void(int)> &task) {
+		if(workers.empty()) {
+			for(int i = 0; i < count; i++) {
+				task(i);
+			}
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mtx);
+		job = &task;
+		job_count = count;
+		next = 0;
+		pending = (int)workers.size();
+		generation++;
+		start_cv.notify_all();
+		done_cv.wait(lock, [this] { return pending == 0; });
+		job = nullptr;
+	}
+
+private:
+	void work() {
+		unsigned long seen = 0;
+		while(true) {
+			const std::function<void(int)> *task;
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				start_cv.wait(lock, [&] { return stop || generation != seen; });
+				if(stop) {
+					return;
+				}
+				seen = generation;
+				task = job;
+				count = job_count;
+			}
+
+			// Claim tasks until the batch is exhausted
+			for(int i = next++; i < count; i = next++) {
+				(*task)(i);
+			}
+
+			std::lock_guard<std::mutex> lock(mtx);
+			if(--pending == 0) {
+				done_cv.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable start_cv, done_cv;
+	const std::function<void(int)> *job = nullptr;
+	int job_count = 0, pending = 0;
+	std::atomic<int> next{0};
+	unsigned long generation = 0;
+	bool stop = false;
+};
+
+// Fixed-size ring of preallocated frames filled by a decoder thread ahead of the tracking loop
+class FrameRing {
+public:
+	// Decodes the rest of video into depth slots shaped like the given frame (slots keeps their buffers for the next ring)
+	FrameRing(cv::VideoCapture &video, int depth, const cv::Mat &like, std::vector<cv::Mat> &slots) : video(video), slots(slots) {
+		slots.resize(depth);
+		for(cv::Mat &slot : slots) {
+			slot.create(like.size(), like.type());
+		}
+		producer = std::thread(&FrameRing::decode, this);
+	}
+
+	~FrameRing() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		space_cv.notify_one();
+		producer.join();
+	}
+
+	// Waits for the next decoded frame (shallow copy of its slot), returns false once the video is exhausted
+	bool pop(cv::Mat &frame) {
+		std::unique_lock<std::mutex> lock(mtx);
+		if(count == 0 && !done) {
+			consumer_stalls++;
+			data_cv.wait(lock, [this] { return count > 0 || done; });
+		}
+		if(count == 0) {
+			return false;
+		}
+		frame = slots[head];
+		return true;
+	}
+
+	// Hands the slot returned by the last pop back to the decoder
+	void release() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			head = (head + 1) % slots.size();
+			count--;
+		}
+		space_cv.notify_one();
+	}
+
+	int depth() const { return (int)slots.size(); }
+	// Counted under the lock but read without it, possibly while the decoder is still running
+	std::atomic<long> producer_stalls{0}, consumer_stalls{0};
+
+private:
+	void decode() {
+		size_t tail = 0;
+		while(true) {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				if(count == slots.size() && !stop) {
+					producer_stalls++;
+					space_cv.wait(lock, [this] { return count < slots.size() || stop; });
+				}
+				if(stop) {
+					break;
+				}
+			}
+
+			// Slot at tail is free so it can be filled without holding the lock
+			if(!video.read(slots[tail])) {
+				break;
 			}
-		} else {
-			std::cerr << "unkown argument: " << argv[i] << std::endl;
-			display_help(argv);
-			return 1;
+			tail = (tail + 1) % slots.size();
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				count++;
+			}
+			data_cv.notify_one();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			done = true;
 		}
+		data_cv.notify_one();
 	}
-	if(PATH.compare("") == 0) {
-		std::cerr << "requires FILEPATH" << std::endl;
-		return 1;
+
+	cv::VideoCapture &video;
+	std::vector<cv::Mat> &slots;
+	size_t head = 0, count = 0;
+	bool done = false, stop = false;
+	std::mutex mtx;
+	std::condition_variable data_cv, space_cv;
+	std::thread producer;
+};
+
+// One time segment of the video, tracked on its own capture and thread
+struct Segment {
+	// Frames [begin, end) of the output come from this segment (end is INT_MAX for the last one)
+	int begin = 0, end = 0;
+	// Frame tracking started on, up to OVERLAP_FRAMES before begin so it overlaps the previous segment
+	int first = -1;
+	// Number of droplets tracked
+	int droplets = 0;
+	// Bbox and success of tracked droplet i on frame j at (j - first) * droplets + i
+	std::vector<cv::Rect> bboxes;
+	std::vector<char> oks;
+	// Output droplet of each tracked droplet, assigned when stitching
+	std::vector<int> ids;
+	std::string error;
+
+	int frames() const { return (int)oks.size() / droplets; }
+	cv::Point2d centre(int j, int i) const {
+		const cv::Rect &b = bboxes[(size_t)(j - first) * droplets + i];
+		return cv::Point2d(b.x + b.width / 2, b.y + b.height / 2);
 	}
-	if(NUM_DROPLETS == 0) {
-		std::cerr << "requires -n DROPLETS" << std::endl;
-		return 1;
+	bool ok(int j, int i) const { return j >= first && j - first < frames() && oks[(size_t)(j - first) * droplets + i]; }
+};
+
+// Tracks seg from seeds on frame begin, or from the first frame in the overlap where every droplet is detected
+void track_segment(Segment &seg, int earliest, std::vector<cv::Rect> seeds, const cv::TrackerCSRT::Params &params,
+	const std::vector<double> &px_diameters, const cv::Rect &window, const Options &opt) {
+	cv::VideoCapture video(opt.PATH);
+	if(!video.isOpened()) {
+		seg.error = "could not open video";
+		return;
 	}
-	if(PX_DISTANCE == 0.0) {
-		std::cerr << "requires -px PIXELS" << std::endl;
-		return 1;
+	int j = seeds.empty() ? earliest : seg.begin;
+	if(j > 0 && !video.set(cv::CAP_PROP_POS_FRAMES, j)) {
+		for(int k = 0; k < j; k++) {
+			video.grab();
+		}
 	}
-	if(DISTANCE == 0.0) {
-		std::cerr << "requires -pd DISTANCE" << std::endl;
-		return 1;
+
+	cv::Mat frame, view, gray;
+	while(true) {
+		if(j > seg.begin || !video.read(frame)) {
+			seg.error = "no frame in " + std::to_string(earliest) + "-" + std::to_string(seg.begin) + " with every droplet detected";
+			return;
+		} else if(!seeds.empty()) {
+			break;
+		}
+		// Only droplets inside the --crop window can be tracked
+		seeds = detect_droplets(frame(window), px_diameters, opt.NUM_DROPLETS);
+		if(seeds.size() == opt.NUM_DROPLETS) {
+			for(cv::Rect &seed : seeds) {
+				seed += window.tl();
+			}
+			break;
+		}
+		seeds.clear();
+		j++;
 	}
-	if(DIAMETERS.size() == 0) {
-		std::cerr << "requires -d DIAMETERS" << std::endl;
-		return 1;
+	seg.first = j;
+
+	// Trackers see the window of each frame, as in the single timeline loop
+	std::vector<cv::Ptr<cv::Tracker>> trackers;
+	SharedFeatures features;
+	cv::Point offset = window.tl();
+	for(j = seg.first; j < seg.end; j++) {
+		if(j > seg.first && !video.read(frame)) {
+			break;
+		}
+		view = frame(window);
+		if(opt.GRAY && frame.channels() > 1) {
+			cv::cvtColor(view, gray, cv::COLOR_BGR2GRAY);
+			view = gray;
+		}
+		if(opt.TRACKER == "shared") {
+			features.compute(view);
+		}
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			cv::Rect local = seeds[i] - offset;
+			bool ok = true;
+			if(j == seg.first) {
+				trackers.push_back(create_tracker(opt.TRACKER, params, features));
+				trackers[i]->init(view, local);
+			} else {
+				ok = trackers[i]->update(view, local);
+				seeds[i] = local + offset;
+			}
+			seg.bboxes.push_back(seeds[i]);
+			seg.oks.push_back(ok);
+		}
 	}
-	return 0;
 }
 
-// Store data to parquet
-arrow::Status store_data(std::string &filepath , std::vector<std::vector<double>> &x, std::vector<std::vector<double>> &y) {
-	// Create fields (column names) and array_vector (data)
-	arrow::FieldVector fields;
-	arrow::ArrayVector array_vector;
+// Tracks SEGMENTS time segments in parallel, stitches them at the boundaries by matching droplets over the overlap and stores the output
+int track_segments(const std::vector<cv::Rect> &bboxes, const cv::TrackerCSRT::Params &params, const std::vector<double> &px_diameters,
+	const cv::Rect &window, double ratio, Options &opt) {
+	// Time the algorithm
+	std::chrono::system_clock::time_point start_time = std::chrono::system_clock::now();
 
-	// Store x,y data into arrow::Table for output
-	for(int i = 0; i < NUM_DROPLETS; i++) {
-		// Create fields for schema (how to store the data)
-		fields.push_back(arrow::field("x_" + std::to_string(i), arrow::float64()));
-		fields.push_back(arrow::field("y_" + std::to_string(i), arrow::float64()));
+	// Split the reported frame count evenly (the last segment runs until the video ends)
+	std::vector<Segment> segments(opt.SEGMENTS);
+	for(int k = 0; k < opt.SEGMENTS; k++) {
+		segments[k].droplets = opt.NUM_DROPLETS;
+		segments[k].begin = (int)((long long)opt.NUM_FRAMES * k / opt.SEGMENTS);
+		segments[k].end = k + 1 < opt.SEGMENTS ? (int)((long long)opt.NUM_FRAMES * (k + 1) / opt.SEGMENTS) : INT_MAX;
+	}
+	std::cout << "Tracking " << opt.SEGMENTS << " segments of ~" << opt.NUM_FRAMES / opt.SEGMENTS << " frames...\n";
+	std::vector<std::thread> threads;
+	for(int k = 0; k < opt.SEGMENTS; k++) {
+		int earliest = k == 0 ? 0 : std::max(segments[k - 1].begin, segments[k].begin - opt.OVERLAP_FRAMES);
+		std::vector<cv::Rect> seeds = k == 0 ? bboxes : std::vector<cv::Rect>();
+		threads.emplace_back([&, k, earliest, seeds]() {
+			track_segment(segments[k], earliest, seeds, params, px_diameters, window, opt);
+		});
+	}
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+	std::cout << "Tracking complete!\n";
 
-		// Store x[i] and y[i] into arrow::Array
-		arrow::DoubleBuilder dbuilder_x;
-		arrow::DoubleBuilder dbuilder_y;
-		std::shared_ptr<arrow::Array> x_array;
-		std::shared_ptr<arrow::Array> y_array;
-		ARROW_RETURN_NOT_OK(dbuilder_x.AppendValues(x[i]));
-		ARROW_RETURN_NOT_OK(dbuilder_y.AppendValues(y[i]));
-		ARROW_RETURN_NOT_OK(dbuilder_x.Finish(&x_array));
-		ARROW_RETURN_NOT_OK(dbuilder_y.Finish(&y_array));
-
-		// Append x and y arrays to array_vector
-		array_vector.push_back(x_array);
-		array_vector.push_back(y_array);
-	}
-
-	// Store droplet diameters
-	fields.push_back(arrow::field("DIAMETERS", arrow::float64()));
-	arrow::DoubleBuilder dbuilder_diam;
-	std::shared_ptr<arrow::Array> diameter_arr;
-	ARROW_RETURN_NOT_OK(dbuilder_diam.AppendValues(DIAMETERS));
-	ARROW_RETURN_NOT_OK(dbuilder_diam.AppendNulls(NUM_FRAMES - DIAMETERS.size()));
-	ARROW_RETURN_NOT_OK(dbuilder_diam.Finish(&diameter_arr));
-	array_vector.push_back(diameter_arr);
-
-	// Store droplet density
-	fields.push_back(arrow::field("DENSITY", arrow::float64()));
-	arrow::DoubleBuilder dbuilder_den;
-	std::shared_ptr<arrow::Array> density_arr;
-	ARROW_RETURN_NOT_OK(dbuilder_den.Append(DENSITY));
-	ARROW_RETURN_NOT_OK(dbuilder_den.AppendNulls(NUM_FRAMES - 1));
-	ARROW_RETURN_NOT_OK(dbuilder_den.Finish(&density_arr));
-	array_vector.push_back(density_arr);
-
-	// Store FPS
-	fields.push_back(arrow::field("FPS", arrow::float64()));
-	arrow::DoubleBuilder dbuilder_fps;
-	std::shared_ptr<arrow::Array> fps_arr;
-	ARROW_RETURN_NOT_OK(dbuilder_fps.Append(FPS));
-	ARROW_RETURN_NOT_OK(dbuilder_fps.AppendNulls(NUM_FRAMES - 1));
-	ARROW_RETURN_NOT_OK(dbuilder_fps.Finish(&fps_arr));
-	array_vector.push_back(fps_arr);
+	// Segments starting past the end of the video (frame count overestimated) are dropped
+	int count = opt.SEGMENTS;
+	for(int k = 0; k < count; k++) {
+		Segment &seg = segments[k];
+		if(seg.error.empty() && seg.frames() > seg.begin - seg.first) {
+			continue;
+		} else if(k > 0 && segments[k - 1].frames() + segments[k - 1].first < seg.begin) {
+			count = k;
+		} else {
+			std::cerr << "Segment " << k + 1 << " (frame " << seg.begin << "): " << (seg.error.empty() ? "no frames read" : seg.error) << std::endl;
+			return -1;
+		}
+	}
+	segments.resize(count);
 
-	// Create schema and data table
-	std::shared_ptr<arrow::Schema> schema = arrow::schema(fields);
-	std::shared_ptr<arrow::Table> table = arrow::Table::Make(schema, array_vector);
+	// Match droplets across each boundary by their mean distance over the frames both segments tracked
+	segments[0].ids.resize(opt.NUM_DROPLETS);
+	for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+		segments[0].ids[i] = i;
+	}
+	for(int k = 1; k < count; k++) {
+		Segment &prev = segments[k - 1], &next = segments[k];
+		std::vector<double> cost((size_t)opt.NUM_DROPLETS * opt.NUM_DROPLETS, DBL_MAX);
+		for(int a = 0; a < opt.NUM_DROPLETS; a++) {
+			for(int b = 0; b < opt.NUM_DROPLETS; b++) {
+				double total = 0.0;
+				int shared = 0;
+				for(int j = next.first; j < next.begin; j++) {
+					if(prev.ok(j, a) && next.ok(j, b)) {
+						total += cv::norm(prev.centre(j, a) - next.centre(j, b));
+						shared++;
+					}
+				}
+				if(shared > 0) {
+					cost[a * opt.NUM_DROPLETS + b] = total / shared;
+				}
+			}
+		}
 
-	// Write table to output file with the schema
-	std::shared_ptr<arrow::io::FileOutputStream> outfile;
-	ARROW_ASSIGN_OR_RAISE(outfile, arrow::io::FileOutputStream::Open(filepath));
-	ARROW_RETURN_NOT_OK(parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), outfile, 3));
-	return outfile->Close();
-}
+		// Greedily pair the closest droplets
+		next.ids.assign(opt.NUM_DROPLETS, -1);
+		std::vector<bool> used(opt.NUM_DROPLETS, false);
+		double worst = 0.0, total = 0.0;
+		for(int n = 0; n < opt.NUM_DROPLETS; n++) {
+			int best = -1;
+			for(int c = 0; c < cost.size(); c++) {
+				if(!used[c / opt.NUM_DROPLETS] && next.ids[c % opt.NUM_DROPLETS] == -1 && (best == -1 || cost[c] < cost[best])) {
+					best = c;
+				}
+			}
+			if(cost[best] == DBL_MAX) {
+				std::cerr << "Segment " << k + 1 << " (frame " << next.begin << "): droplets could not be matched over the overlap" << std::endl;
+				return -1;
+			}
+			used[best / opt.NUM_DROPLETS] = true;
+			next.ids[best % opt.NUM_DROPLETS] = prev.ids[best / opt.NUM_DROPLETS];
+			worst = std::max(worst, cost[best]);
+			total += cost[best];
+		}
 
-// Get most significant bit
-int getMSB(int val) {
-	if(val == 0) {
-		return 0;
+		// Display stitch residuals in microns
+		std::cout << "Stitch at frame " << next.begin << " (" << next.begin - next.first << " overlap frames): residual "
+			<< total / opt.NUM_DROPLETS * ratio << " um mean, " << worst * ratio << " um max" << std::endl;
 	}
-	int msb = 0;
-	val = val / 2;
-	while(val != 0) {
-		val = val / 2;
-		msb++;
+
+	// Copy each segment's own frames into the trajectories under the stitched droplet ids
+	Segment &last = segments[count - 1];
+	opt.NUM_FRAMES = last.first + last.frames();
+	Trajectories traj(opt.NUM_DROPLETS, opt.LONG);
+	arrow::Status st = traj.reserve(opt.NUM_FRAMES);
+	if(!st.ok()) {
+		std::cerr << st << std::endl;
+		return -1;
 	}
-	return (1 << msb);
+	// Failures are reported once per gap, as in the single timeline loop
+	std::vector<char> lost(opt.NUM_DROPLETS, 0);
+	for(int k = 0; k < count; k++) {
+		Segment &seg = segments[k];
+		for(int j = seg.begin; j < std::min(seg.first + seg.frames(), k + 1 < count ? segments[k + 1].begin : INT_MAX); j++) {
+			for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+				int id = seg.ids[i];
+				if(seg.ok(j, i)) {
+					traj.store(id, j, seg.bboxes[(size_t)(j - seg.first) * opt.NUM_DROPLETS + i], ratio);
+					lost[id] = false;
+				} else {
+					if(!lost[id]) {
+						std::cerr << "Tracking Failure Detected!\tDroplet: " << id + 1 << "\tFrame: " << j << std::endl;
+						lost[id] = true;
+					}
+					traj.store_gap(id, j);
+				}
+			}
+		}
+	}
+
+	// Store data in output file
+	std::cout << "Storing data...\n";
+	std::string extension = opt.FORMAT == "parquet" ? ".parquet" : opt.FORMAT == "feather" ? ".feather" : ".arrow";
+	std::string out_file_name = std::filesystem::path(opt.PATH).stem().string() + "_out" + extension;
+	st = store_data(out_file_name, traj, opt);
+	if(!st.ok()) {
+		std::cerr << st << std::endl;
+	} else {
+		std::cout << "Data Stored!\n";
+	}
+
+	// Display total runtime of algorithm
+	if(opt.TIMEIT) {
+		std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time;
+		std::cout << "Elapsed time: " << elapsed_seconds.count() << " s" << std::endl;
+	}
+	return 0;
 }
 
-// Program entry
-int main(int argc, char** argv) {
-	// Parse arguements and ends program if error
-	if(parse_args(argc, argv) == 1) {
+// Tracks the video given by the parsed options (NUM_FRAMES, FPS and DIAMETERS are updated from the video)
+// ring_slots holds the --ring frame buffers, kept by the caller so they can be reused for the next video
+int track_video(Options &opt, std::vector<cv::Mat> &ring_slots) {
+	// Load the bboxes of --rois
+	if(opt.ROIS_PATH.compare("") != 0 && load_rois(opt) == 1) {
 		return 1;
 	}
+	bool headless = opt.ROIS_PATH.compare("") != 0 || opt.DETECT || opt.RESUME;
+
+	// Load the checkpoint to resume from
+	Checkpoint checkpoint(std::filesystem::path(opt.PATH).stem().string() + "_out.ckpt", opt.NUM_DROPLETS);
+	int first_frame = 0;
+	cv::Rect resume_window;
+	std::vector<cv::Rect> resume_bboxes;
+	std::vector<int> resume_start_frames, resume_lost_since;
+	std::vector<int32_t> history;
+	if(opt.RESUME) {
+		if(checkpoint.load(first_frame, resume_window, resume_bboxes, resume_start_frames, resume_lost_since, history) == 1) {
+			return 1;
+		}
+		std::cout << "Resuming from frame " << first_frame << std::endl;
+	} else if(opt.CHECKPOINT_FRAMES > 0) {
+		checkpoint.reset();
+	}
 
 	// Calculates ratio (microns : px)
-	double ratio = DISTANCE / PX_DISTANCE;
+	double ratio = opt.DISTANCE / opt.PX_DISTANCE;
 
 	// Updates diameters from pixels to microns
-	for(int i = 0; i < DIAMETERS.size(); i++) {
-		DIAMETERS[i] = DIAMETERS[i] * ratio;
+	std::vector<double> px_diameters = opt.DIAMETERS;
+	for(int i = 0; i < opt.DIAMETERS.size(); i++) {
+		opt.DIAMETERS[i] = opt.DIAMETERS[i] * ratio;
 	}
 
 	// Opens video and reads into frame
-	cv::VideoCapture video(PATH);
+	cv::VideoCapture video(opt.PATH);
 	cv::Mat frame;
-	bool ok = video.read(frame);
+	video.read(frame);
 	if(!video.isOpened()) {
 		std::cerr << "Could not open video" << std::endl;
 		return -1;
 	}
 
-	// Gets number of frames in video and FPS
-	NUM_FRAMES = (int)video.get(cv::CAP_PROP_FRAME_COUNT);
-	FPS = video.get(cv::CAP_PROP_FPS);
+	// Gets number of frames in video (an estimate for some containers, corrected once tracking ends) and FPS
+	opt.NUM_FRAMES = std::max(1, (int)video.get(cv::CAP_PROP_FRAME_COUNT));
+	opt.FPS = video.get(cv::CAP_PROP_FPS);
+
+	// Seek to the checkpointed frame (decoding up to it if the container cannot seek)
+	if(first_frame > 0) {
+		if(!video.set(cv::CAP_PROP_POS_FRAMES, first_frame)) {
+			for(int j = 1; j < first_frame; j++) {
+				video.grab();
+			}
+		}
+		if(!video.read(frame)) {
+			std::cerr << "Could not read checkpointed frame " << first_frame << std::endl;
+			return -1;
+		}
+	}
+
+	// CSRT parameters shared by every droplet
+	cv::TrackerCSRT::Params params;
+	if(csrt_params(params, opt) == 1) {
+		return 1;
+	}
+
+	// Detect droplets on the first frame
+	if(opt.DETECT && !opt.RESUME) {
+		opt.SEED_BBOXES = detect_droplets(frame, px_diameters, opt.NUM_DROPLETS);
+		if(opt.SEED_BBOXES.size() != opt.NUM_DROPLETS) {
+			std::cerr << "Detected " << opt.SEED_BBOXES.size() << " of " << opt.NUM_DROPLETS << " droplets" << std::endl;
+			return 1;
+		}
+		opt.SEED_FRAMES.assign(opt.NUM_DROPLETS, 0);
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			cv::Rect &b = opt.SEED_BBOXES[i];
+			std::cout << "Detected droplet " << i + 1 << ": " << b.x << "," << b.y << "," << b.width << "," << b.height << std::endl;
+		}
+	}
 
-	// Initializes a vector of trackers and bboxes
+	// Initializes a vector of trackers and bboxes (--tracker shared samples the features of each frame computed once)
+	SharedFeatures features;
 	std::vector<cv::Ptr<cv::Tracker>> trackers;
 	std::vector<cv::Rect> bboxes;
-	for(int i = 0; i < NUM_DROPLETS; i++) {
+	std::vector<int> start_frames(opt.NUM_DROPLETS, 0);
+	for(int i = 0; i < opt.NUM_DROPLETS; i++) {
 		// Create tracker and bbox
-		trackers.push_back(cv::TrackerCSRT::create());
-		if(i == 0) {
+		trackers.push_back(create_tracker(opt.TRACKER, params, features));
+		if(opt.RESUME) {
+			bboxes.push_back(resume_bboxes[i]);
+			start_frames[i] = resume_start_frames[i];
+		} else if(headless) {
+			bboxes.push_back(opt.SEED_BBOXES[i]);
+			start_frames[i] = opt.SEED_FRAMES[i];
+		} else if(i == 0) {
 			bboxes.push_back(cv::selectROI(frame, false));
 		} else {
 			bboxes.push_back(cv::selectROI(frame, false, false, false));
 		}
-		
-		// Initialize tracker
-		trackers[i]->init(frame, bboxes[i]);
 	}
 
 	// Close select ROI window
-	cv::destroyAllWindows();
+	if(!headless) {
+		cv::destroyAllWindows();
+	}
+
+	// Analysis window trackers work in (whole frame unless cropping)
+	cv::Rect window(0, 0, frame.cols, frame.rows);
+	if(opt.RESUME) {
+		window = resume_window;
+	} else if(opt.CROP_MARGIN >= 0) {
+		cv::Rect bounds = bboxes[0];
+		for(const cv::Rect &bbox : bboxes) {
+			bounds |= bbox;
+		}
+		window &= cv::Rect(bounds.x - opt.CROP_MARGIN, bounds.y - opt.CROP_MARGIN, bounds.width + 2 * opt.CROP_MARGIN, bounds.height + 2 * opt.CROP_MARGIN);
+		std::cout << "Analysis window: " << window.x << "," << window.y << "," << window.width << "," << window.height << std::endl;
+	}
+	cv::Point offset = window.tl();
+
+	// Trackers see the window of each frame, converted to gray once per frame if requested
+	cv::Mat view = frame(window), gray;
+	if(opt.GRAY && frame.channels() > 1) {
+		cv::cvtColor(view, gray, cv::COLOR_BGR2GRAY);
+		view = gray;
+	}
+
+	// Track time segments in parallel instead of one timeline
+	if(opt.SEGMENTS > 1) {
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			if(start_frames[i] != 0) {
+				std::cerr << "--segments K requires every droplet to start on frame 0" << std::endl;
+				return 1;
+			}
+		}
+		video.release();
+		return track_segments(bboxes, params, px_diameters, window, ratio, opt);
+	}
+
+	// Initialize trackers on the window, or with -k the region around each droplet (seeded droplets may start on a later frame)
+	if(opt.TRACKER == "shared") {
+		features.compute(view);
+	}
+	std::vector<Predictor> predictors(opt.KALMAN ? opt.NUM_DROPLETS : 0);
+
+	// Lost droplets (frame lost on, -1 while tracked) and the last bbox each droplet was tracked at
+	std::vector<int> lost_since = opt.RESUME ? resume_lost_since : std::vector<int>(opt.NUM_DROPLETS, -1);
+	std::vector<cv::Rect> last_good = bboxes;
+	int failures = 0, recoveries = 0, longest_loss = 0;
+	long recovery_frames = 0;
+	for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+		if(start_frames[i] <= first_frame) {
+			cv::Rect local = bboxes[i] - offset, region(0, 0, view.cols, view.rows);
+			if(opt.KALMAN) {
+				region = predictors[i].init(local, view.size());
+			}
+			trackers[i]->init(view(region), local - region.tl());
+		}
+	}
+
+	// Start tracker update workers (updates of different droplets are independent)
+	WorkerPool pool(std::min(opt.THREADS, opt.NUM_DROPLETS));
+	std::vector<char> oks(opt.NUM_DROPLETS, 0);
+	Histogram update_times;
+	Profiler profiler(opt.TIMEIT, opt.TRACE_PATH);
+	if(opt.TRACE_PATH.compare("") != 0 && !profiler.tracing()) {
+		std::cerr << "could not write " << opt.TRACE_PATH << std::endl;
+		return 1;
+	}
+
+	// Show tracked frames on the main thread while tracking runs on its own
+	std::unique_ptr<Display> display;
+	if(opt.SHOW) {
+		display = std::make_unique<Display>(opt.CROP_MARGIN >= 0 ? window : cv::Rect(), profiler);
+	}
+
+	// Encode annotated frames on their own thread
+	std::unique_ptr<OverlayWriter> overlay;
+	if(opt.OVERLAY_PATH.compare("") != 0) {
+		overlay = std::make_unique<OverlayWriter>();
+		if(overlay->open(opt.OVERLAY_PATH, opt.FPS / opt.OVERLAY_EVERY, frame.size(), opt.OVERLAY_SCALE, opt.CROP_MARGIN >= 0 ? window : cv::Rect()) == 1) {
+			return 1;
+		}
+	}
+
+	// Start decoding ahead of the tracking loop
+	std::unique_ptr<FrameRing> ring;
+	if(opt.RING_DEPTH > 0) {
+		ring = std::make_unique<FrameRing>(video, opt.RING_DEPTH, frame, ring_slots);
+	}
+
+	// Initialize droplet trajectories (only the rows not yet written when streaming)
+	int num_rows = opt.STREAM_ROWS > 0 ? opt.STREAM_ROWS : opt.NUM_FRAMES;
+	Trajectories traj(opt.NUM_DROPLETS, opt.LONG, opt.KALMAN);
+	arrow::Status st = traj.reserve(num_rows);
+	if(!st.ok()) {
+		std::cerr << st << std::endl;
+		return -1;
+	}
+
+	// Open streaming output
+	std::string extension = opt.FORMAT == "parquet" ? ".parquet" : opt.FORMAT == "feather" ? ".feather" : ".arrow";
+	std::string out_file_name = std::filesystem::path(opt.PATH).stem().string() + "_out" + extension;
+	PartWriter stream(opt);
+	if(opt.STREAM_ROWS > 0) {
+		st = stream.open(out_file_name);
+		if(!st.ok()) {
+			std::cerr << st << std::endl;
+			return -1;
+		}
+	}
 
-	// Initialize 2-D array of x and y values
-	std::vector<std::vector<double>> x(NUM_DROPLETS, std::vector<double>(NUM_FRAMES, 0.0));
-	std::vector<std::vector<double>> y(NUM_DROPLETS, std::vector<double>(NUM_FRAMES, 0.0));
+	// Makes room in traj for frame j (writing out a full block when streaming, growing past the reported frame count otherwise)
+	auto prepare_row = [&](int j) -> arrow::Status {
+		if(j - traj.first_row < traj.rows()) {
+			return arrow::Status::OK();
+		} else if(opt.STREAM_ROWS > 0) {
+			std::chrono::steady_clock::time_point store_start = std::chrono::steady_clock::now();
+			arrow::Status flushed = stream.flush(traj, traj.rows());
+			profiler.record(Profiler::STORE, store_start, j);
+			return flushed;
+		}
+		return traj.reserve(traj.rows() + 1);
+	};
 
 	// Time the algorithm
 	std::chrono::system_clock::time_point start_time;
-	if(TIMEIT) {
+	if(opt.TIMEIT) {
 		start_time = std::chrono::system_clock::now();
 	}
 
-	// Store first frame values
-	for(int i = 0; i < NUM_DROPLETS; i++) {
-		x[i][0] = (bboxes[i].x + bboxes[i].width / 2) * ratio;
-		y[i][0] = (bboxes[i].y + bboxes[i].height / 2) * ratio;
+	// Store first frame values (every frame up to the checkpoint when resuming, gaps and unseeded frames included)
+	std::vector<char> stored(opt.NUM_DROPLETS, 0);
+	if(opt.RESUME) {
+		const int32_t *record = history.data();
+		for(int j = 0; j <= first_frame; j++) {
+			st = prepare_row(j);
+			if(!st.ok()) {
+				std::cerr << st << std::endl;
+				return -1;
+			}
+			for(int i = 0; i < opt.NUM_DROPLETS; i++, record += 5) {
+				if(record[4]) {
+					last_good[i] = cv::Rect(record[0], record[1], record[2], record[3]);
+					traj.store(i, j, last_good[i], ratio);
+				} else if(start_frames[i] > j) {
+					traj.store_unseeded(i, j);
+				} else {
+					traj.store_gap(i, j);
+				}
+			}
+		}
+	} else {
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			stored[i] = start_frames[i] == 0;
+			if(stored[i]) {
+				traj.store(i, 0, bboxes[i], ratio);
+			} else {
+				traj.store_unseeded(i, 0);
+			}
+			if(stored[i] && opt.KALMAN) {
+				traj.store_filtered(i, 0, predictors[i].position() + cv::Point2d(offset), predictors[i].velocity(), ratio, opt.FPS);
+			}
+		}
+		if(opt.CHECKPOINT_FRAMES > 0) {
+			checkpoint.record(bboxes, stored);
+		}
+	}
+	if(overlay && first_frame % opt.OVERLAY_EVERY == 0) {
+		overlay->push(frame, first_frame, bboxes, stored);
 	}
 
 	// Display progress bar (updates in roughly 5% intervals)
 	int pCount = 0;
-	int pUpdateFrame = getMSB(NUM_FRAMES / 20);
-	float pRatio = (float)(pUpdateFrame * 100.0 / NUM_FRAMES);
-	std::string pBar = '[' + std::string(ceil((float)NUM_FRAMES / pUpdateFrame), '.') + ']';
-	std::cout << "Tracking...\n";
-	std::cout << pBar << " " << std::setprecision(4) << pCount * pRatio << "%\t\r";
-	// Tracking loop
-	for(int j = 1; j < NUM_FRAMES; j++) {
-		// Read next frame
-		video.read(frame);
-		
-		// Update each tracker
-		for(int i = 0; i < NUM_DROPLETS; i++) {
-			ok = trackers[i]->update(frame, bboxes[i]);
-			if(ok) {
-				// Tracking success
-				x[i][j] = (bboxes[i].x + bboxes[i].width / 2) * ratio;
-				y[i][j] = (bboxes[i].y + bboxes[i].height / 2) * ratio;
-
-				// Draw rectangle on frame if displaying trackers
-				if(SHOW) {
-					cv::rectangle(frame, bboxes[i], cv::Scalar(255, 0, 0), 2, 1);
+	int pUpdateFrame = std::max(1, getMSB(opt.NUM_FRAMES / 20));
+	float pRatio = (float)(pUpdateFrame * 100.0 / opt.NUM_FRAMES);
+	std::string pBar = '[' + std::string(ceil((float)opt.NUM_FRAMES / pUpdateFrame), '.') + ']';
+	while(pCount < first_frame / pUpdateFrame && pCount + 2 < pBar.size()) {
+		pBar[++pCount] = '=';
+	}
+	if(!opt.BATCH) {
+		std::cout << "Tracking...\n";
+		std::cout << pBar << " " << std::setprecision(4) << pCount * pRatio << "%\t\r";
+	}
+	// Tracking loop (until the video runs out, whatever frame count it reported), -1 if a row could not be stored
+	int frames = first_frame + 1;
+	auto track = [&]() -> int {
+		for(int j = first_frame + 1; ; j++) {
+			// Read next frame (time spent waiting on the ring when decoding ahead)
+			std::chrono::steady_clock::time_point decode_start = std::chrono::steady_clock::now();
+			if(display || overlay) {
+				// The display or overlay may still hold the last frame, so decode into a new buffer
+				frame.release();
+			}
+			if(ring) {
+				if(!ring->pop(frame)) {
+					break;
 				}
-			} else {
-				// Tracking failure
-				std::cerr << "Tracking Failure Detected!\tDroplet: " << i + 1 << "\tFrame: " << j << std::endl;
+			} else if(!video.read(frame)) {
+				break;
+			}
+			profiler.record(Profiler::DECODE, decode_start, j);
+			frames++;
+			st = prepare_row(j);
+			if(!st.ok()) {
+				std::cerr << st << std::endl;
+				return -1;
+			}
+			view = frame(window);
+			if(opt.GRAY && frame.channels() > 1) {
+				cv::cvtColor(view, gray, cv::COLOR_BGR2GRAY);
+				view = gray;
+			}
+			if(opt.TRACKER == "shared") {
+				std::chrono::steady_clock::time_point features_start = std::chrono::steady_clock::now();
+				features.compute(view);
+				profiler.record(Profiler::EXTRACT, features_start, j);
+			}
+			
+			// Update each tracker in window coordinates (waits for every droplet before moving to the next frame)
+			std::chrono::steady_clock::time_point update_start = std::chrono::steady_clock::now();
+			pool.run(opt.NUM_DROPLETS, [&](int i) {
+				cv::Rect local = bboxes[i] - offset, region(0, 0, view.cols, view.rows);
+				std::chrono::steady_clock::time_point droplet_start = std::chrono::steady_clock::now();
+				if(start_frames[i] == j) {
+					if(opt.KALMAN) {
+						region = predictors[i].init(local, view.size());
+					}
+					trackers[i]->init(view(region), local - region.tl());
+					oks[i] = true;
+				} else if(opt.RECOVERY && lost_since[i] >= 0) {
+					// Re-detect a lost droplet and restart its tracker where it was found
+					std::vector<cv::Rect> others;
+					for(int k = 0; k < opt.NUM_DROPLETS; k++) {
+						if(k != i && start_frames[k] < j && lost_since[k] < 0) {
+							others.push_back(last_good[k] - offset);
+						}
+					}
+					if(opt.KALMAN) {
+						predictors[i].predict();
+					}
+					double diameter = px_diameters[std::min(i, (int)px_diameters.size() - 1)];
+					local = redetect(view, last_good[i] - offset, diameter, j - lost_since[i], others);
+					oks[i] = !local.empty();
+					if(oks[i]) {
+						if(opt.KALMAN) {
+							region = predictors[i].init(local, view.size());
+						}
+						trackers[i] = create_tracker(opt.TRACKER, params, features);
+						trackers[i]->init(view(region), local - region.tl());
+						bboxes[i] = local + offset;
+					}
+				} else if(start_frames[i] < j) {
+					// With -k the tracker sees the region around the predicted position
+					if(opt.KALMAN) {
+						region = predictors[i].predict();
+					}
+					local -= region.tl();
+					oks[i] = trackers[i]->update(view(region), local);
+					local += region.tl();
+					if(opt.KALMAN) {
+						predictors[i].correct(local, oks[i]);
+					}
+					bboxes[i] = local + offset;
+				}
+				profiler.record(Profiler::UPDATE, droplet_start, j, i);
+			});
+			std::chrono::duration<double, std::micro> update_time = std::chrono::steady_clock::now() - update_start;
+			update_times.add(update_time.count());
+
+			// Store positions
+			std::chrono::steady_clock::time_point results_start = std::chrono::steady_clock::now();
+			for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+				stored[i] = start_frames[i] <= j && oks[i];
+				if(start_frames[i] > j) {
+					// Droplet not seeded yet
+					traj.store_unseeded(i, j);
+					continue;
+				}
+				if(opt.KALMAN) {
+					// Filtered state, predicted only if tracking failed
+					traj.store_filtered(i, j, predictors[i].position() + cv::Point2d(offset), predictors[i].velocity(), ratio, opt.FPS);
+				}
+				if(oks[i]) {
+					// Tracking success (possibly after a gap)
+					if(lost_since[i] >= 0) {
+						int latency = j - lost_since[i];
+						std::cerr << "Droplet Recovered!\tDroplet: " << i + 1 << "\tFrame: " << j << "\tFrames lost: " << latency << std::endl;
+						recoveries++;
+						longest_loss = std::max(longest_loss, latency);
+						recovery_frames += latency;
+						lost_since[i] = -1;
+					}
+					last_good[i] = bboxes[i];
+					traj.store(i, j, bboxes[i], ratio);
+				} else {
+					// Tracking failure (reported once per gap)
+					if(lost_since[i] < 0) {
+						std::cerr << "Tracking Failure Detected!\tDroplet: " << i + 1 << "\tFrame: " << j << std::endl;
+						failures++;
+						lost_since[i] = j;
+					}
+					traj.store_gap(i, j);
+				}
+			}
+			profiler.record(Profiler::RESULTS, results_start, j);
+			
+			// Save the tracking state
+			if(opt.CHECKPOINT_FRAMES > 0) {
+				checkpoint.record(bboxes, stored);
+				if(j % opt.CHECKPOINT_FRAMES == 0 && !checkpoint.save(j, window, bboxes, start_frames, lost_since)) {
+					std::cerr << "Could not save checkpoint at frame " << j << std::endl;
+				}
+			}
+
+			// Hand the frame to the display and overlay threads (ring slots are reused by the decoder, so those are copied)
+			bool overlaid = overlay && j % opt.OVERLAY_EVERY == 0;
+			if(display || overlaid) {
+				cv::Mat handoff = ring ? frame.clone() : frame;
+				if(overlaid) {
+					overlay->push(handoff, j, bboxes, stored);
+				}
+				if(display) {
+					display->post(handoff, j, bboxes, stored);
+					if(display->closed()) { break; }
+				}
+			}
+
+			// Return frame slot to the decoder
+			if(ring) {
+				ring->release();
 			}
-		}
-		
-		// Update tracking display window
-		if(SHOW) {
-			cv::imshow("Tracking", frame);
-			int k = cv::waitKey(1);
-			if(k == 27) { break; }
-		}
 
-		// Update progress bar
-		if(!(j & (pUpdateFrame - 1))) {
-			pBar[++pCount] = '=';
-			std::cout << pBar << " " << std::setprecision(4) << pCount * pRatio << "%\t\r";
+			// Update progress bar
+			if(!opt.BATCH && !(j & (pUpdateFrame - 1)) && pCount + 2 < pBar.size()) {
+				std::chrono::steady_clock::time_point progress_start = std::chrono::steady_clock::now();
+				pBar[++pCount] = '=';
+				std::cout << pBar << " " << std::setprecision(4) << pCount * pRatio << "%\t\r";
+				profiler.record(Profiler::PROGRESS, progress_start, j);
+			}
 		}
+		return 0;
+	};
+
+	// HighGUI is only safe on the main thread, so with -s the loop runs on a thread of its own while this one shows its frames
+	int status;
+	if(display) {
+		std::thread tracking([&]() {
+			status = track();
+			display->close();
+		});
+		display->run();
+		tracking.join();
+	} else {
+		status = track();
+	}
+	if(status != 0) {
+		return status;
 	}
 
 	// Display tracking complete
-	pBar[++pCount] = '=';
-	std::cout << pBar << " 100%\t\n";
+	opt.NUM_FRAMES = frames;
+	if(pCount + 2 < pBar.size()) {
+		pBar[++pCount] = '=';
+	}
+	if(!opt.BATCH) {
+		std::cout << pBar << " 100%\t\n";
+	}
 	std::cout << "Tracking complete!\n";
 
-	// Store data in paruqet file
+	// Display failures and how long recovered droplets were lost
+	if(failures > 0) {
+		int still_lost = 0;
+		long missing = recovery_frames;
+		for(int i = 0; i < opt.NUM_DROPLETS; i++) {
+			if(lost_since[i] >= 0) {
+				still_lost++;
+				missing += frames - lost_since[i];
+			}
+		}
+		std::cout << "Tracking failures: " << failures << ", " << recoveries << " recovered";
+		if(recoveries > 0) {
+			std::cout << " after " << (double)recovery_frames / recoveries << " frames avg (" << longest_loss << " max)";
+		}
+		std::cout << ", " << still_lost << " still lost at the end, " << missing << " droplet frames missing" << std::endl;
+	}
+
+	// Display frames the preview skipped to keep up
+	if(display) {
+		std::cout << "Display: " << display->shown << " frames shown, " << display->skipped << " skipped" << std::endl;
+	}
+
+	// Finish the overlay video (tracking waited on a full encoder queue producer_stalls times)
+	if(overlay) {
+		overlay->close();
+		std::cout << "Overlay: " << overlay->written << " frames written to " << opt.OVERLAY_PATH << ", " << overlay->producer_stalls << " tracker stalls" << std::endl;
+	}
+
+	// Display decode stalls (producer waited on a full ring, tracker waited on an empty one)
+	if(ring) {
+		std::cout << "Decode ring (depth " << ring->depth() << "): " << ring->producer_stalls << " decoder stalls, "
+			<< ring->consumer_stalls << " tracker stalls" << std::endl;
+		ring.reset();
+	}
+
+	// Store data in output file
 	std::cout << "Storing data...\n";
-	std::string out_file_name = std::filesystem::path(PATH).stem().string() + "_out.parquet";
-	arrow::Status st = store_data(out_file_name, x, y);
+	std::chrono::steady_clock::time_point store_start = std::chrono::steady_clock::now();
+	if(opt.STREAM_ROWS > 0) {
+		st = stream.close(traj, opt.NUM_FRAMES);
+	} else {
+		st = store_data(out_file_name, traj, opt);
+	}
 	if(!st.ok()) {
 		std::cerr << st << std::endl;
 	} else {
 		std::cout << "Data Stored!\n";
+		if(opt.CHECKPOINT_FRAMES > 0 || opt.RESUME) {
+			checkpoint.remove();
+		}
+	}
+	profiler.record(Profiler::STORE, store_start, -1);
+	if(opt.TRACE_PATH.compare("") != 0 && profiler.close_trace() == 0) {
+		std::cout << "Trace written to " << opt.TRACE_PATH << std::endl;
 	}
 
 	// Display total runtime of algorithm
 	std::chrono::system_clock::time_point end_time;
-	if(TIMEIT) {
+	if(opt.TIMEIT) {
 		end_time = std::chrono::system_clock::now();
 		std::chrono::duration<double> elapsed_seconds = end_time - start_time;
 		std::cout << "Elapsed time: " << elapsed_seconds.count() << " s" << std::endl;
+
+		// Per-frame tracker update time
+		if(update_times.calls() > 0) {
+			std::cout << "Tracker update time: " << update_times.mean() / 1000.0 << " ms/frame avg, " << update_times.max() / 1000.0 << " ms/frame max ("
+				<< opt.NUM_DROPLETS << " droplets, " << opt.THREADS << " threads)" << std::endl;
+			std::cout << "Tracker update percentiles: " << update_times.percentile(50) / 1000.0 << " / " << update_times.percentile(95) / 1000.0 << " / "
+				<< update_times.percentile(99) / 1000.0 << " ms/frame (p50 / p95 / p99)" << std::endl;
+			std::cout << "Tracker input: " << view.cols << "x" << view.rows << "x" << view.channels() << " ("
+				<< view.total() * view.elemSize() / 1024.0 << " KiB/frame)" << std::endl;
+		}
+
+		// Time of each stage (update per droplet, the others per frame)
+		profiler.report();
 	}
 
 	// Garbage collection
 	video.release();
-	cv::destroyAllWindows();
+	if(!headless || opt.SHOW) {
+		cv::destroyAllWindows();
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+// One video of a batch manifest
+struct BatchJob {
+	std::vector<std::string> args;
+	int droplets = 0, frames = 0, status = 0;
+	double seconds = 0.0;
+};
+
+// Splits a manifest line into arguments (quotes group words, e.g. -d "20 10")
+std::vector<std::string> split_args(const std::string &line) {
+	std::vector<std::string> args;
+	std::string arg;
+	char quote = 0;
+	bool pending = false;
+	for(char c : line) {
+		if(quote != 0 && c == quote) {
+			quote = 0;
+		} else if(quote == 0 && (c == '"' || c == '\'')) {
+			quote = c;
+			pending = true;
+		} else if(quote == 0 && std::isspace((unsigned char)c)) {
+			if(pending) {
+				args.push_back(arg);
+				arg.clear();
+				pending = false;
+			}
+		} else {
+			arg += c;
+			pending = true;
+		}
+	}
+	if(pending) {
+		args.push_back(arg);
+	}
+	return args;
+}
+
+// Tracks every video of manifest on jobs worker threads and displays a throughput summary
+int run_batch(const std::string &program, const std::string &manifest, int jobs, const std::vector<std::string> &shared) {
+	std::ifstream file(manifest);
+	if(!file.is_open()) {
+		std::cerr << manifest << " does not exist or is not a file" << std::endl;
+		return 1;
+	}
+
+	// Video path first, then the shared options, then the line's own options so they take precedence
+	std::vector<BatchJob> batch;
+	std::string line;
+	while(std::getline(file, line)) {
+		std::vector<std::string> args = split_args(line);
+		if(args.empty() || args[0][0] == '#') {
+			continue;
+		}
+		BatchJob job;
+		job.args = {program, args[0]};
+		job.args.insert(job.args.end(), shared.begin(), shared.end());
+		job.args.insert(job.args.end(), args.begin() + 1, args.end());
+		batch.push_back(job);
+	}
+	if(batch.empty()) {
+		std::cerr << manifest << " lists no videos" << std::endl;
+		return 1;
+	}
+
+	// Workers take the next video until none are left, parsing its options afresh
+	// A worker keeps its decoder ring buffers between videos; trackers are rebuilt since init() allocates their model anyway
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	std::atomic<int> next(0);
+	std::vector<std::thread> workers;
+	for(int w = 0; w < std::min(jobs, (int)batch.size()); w++) {
+		workers.emplace_back([&]() {
+			std::vector<cv::Mat> ring_slots;
+			for(int k = next++; k < batch.size(); k = next++) {
+				BatchJob &job = batch[k];
+				std::vector<char*> argv;
+				for(std::string &arg : job.args) {
+					argv.push_back(&arg[0]);
+				}
+				Options opt;
+				opt.BATCH = true;
+				std::chrono::steady_clock::time_point job_start = std::chrono::steady_clock::now();
+				job.status = parse_args((int)argv.size(), argv.data(), opt) == 1 ? 1 : track_video(opt, ring_slots);
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - job_start;
+				job.seconds = elapsed.count();
+				job.droplets = opt.NUM_DROPLETS;
+				job.frames = job.status == 0 ? opt.NUM_FRAMES : 0;
+			}
+		});
+	}
+	for(std::thread &worker : workers) {
+		worker.join();
+	}
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start_time;
+
+	// Display throughput of each video and of the whole batch
+	long total_frames = 0;
+	int failed = 0;
+	std::cout << std::endl << "video\tdroplets\tframes\ttime (s)\tfps\tstatus" << std::endl;
+	for(const BatchJob &job : batch) {
+		std::cout << job.args[1] << "\t" << job.droplets << "\t" << job.frames << "\t" << job.seconds << "\t"
+			<< (job.seconds > 0 ? job.frames / job.seconds : 0.0) << "\t" << (job.status == 0 ? "ok" : "failed") << std::endl;
+		total_frames += job.frames;
+		failed += job.status != 0;
+	}
+	std::cout << batch.size() << " videos (" << failed << " failed) on " << jobs << " jobs: " << total_frames << " frames in "
+		<< wall.count() << " s (" << total_frames / wall.count() << " fps)" << std::endl;
+	return failed > 0 ? 1 : 0;
+}
+
+// Program entry
+int main(int argc, char** argv) {
+	// Batch mode takes its videos from a manifest, every other argument applies to each of them
+	std::string manifest = "";
+	int jobs = 1;
+	std::vector<std::string> shared;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--batch") == 0) {
+			if(i + 1 < argc) {
+				manifest = argv[++i];
+			} else {
+				std::cerr << "--batch MANIFEST option requires one argument" << std::endl;
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--jobs") == 0) {
+			if(i + 1 < argc) {
+				jobs = std::strtol(argv[++i], NULL, 10);
+			} else {
+				std::cerr << "--jobs JOBS option requires one argument" << std::endl;
+				return 1;
+			}
+		} else {
+			shared.push_back(argv[i]);
+		}
+	}
+	if(manifest.compare("") == 0) {
+		// Parse arguements and ends program if error
+		Options opt;
+		if(parse_args(argc, argv, opt) == 1) {
+			return 1;
+		}
+		std::vector<cv::Mat> ring_slots;
+		return track_video(opt, ring_slots);
+	} else if(jobs < 1) {
+		std::cerr << "--jobs JOBS must be at least 1" << std::endl;
+		return 1;
+	}
+	return run_batch(argv[0], manifest, jobs, shared);
+}
@@ -18,14 +18,18 @@ def plotter(DATA_OUT_FILE):
         n   <double>    <double>    ...     <double>    <double>    NULL        NULL        NULL
         ...
         N-1 <double>    <double>    ...     <double>    <double>    NULL        NULL        NULL
+        followed by vx_i, vy_i, ax_i, ay_i, Fx_i, Fy_i for each droplet if tracked with --analysis (used instead of recomputing them)
+        x_i and y_i are NaN on frames where droplet i was lost, which are left as gaps in the plots
     '''
 
-    # Get number of columns and rows from data file metadata
-    numCols = read_metadata(DATA_OUT_FILE).num_columns
-    numRows = read_metadata(DATA_OUT_FILE).num_rows
+    # Get column names and number of rows from data file metadata
+    metadata = read_metadata(DATA_OUT_FILE)
+    colNames = metadata.schema.names
+    numRows = metadata.num_rows
+    analysed = "ax_0" in colNames
 
     # Get DIAMETERS, DENSITY, and FPS from parquet
-    numDroplets = (numCols - 3) // 2
+    numDroplets = len([name for name in colNames if name.startswith("x_")])
     DIAMETERS = pd.read_parquet(DATA_OUT_FILE, columns=["DIAMETERS"]).to_numpy()[:][:numDroplets]
     DIAMETERS = np.reshape(DIAMETERS, numDroplets)
     DENSITY = pd.read_parquet(DATA_OUT_FILE, columns=["DENSITY"]).to_numpy()[0][0]
@@ -53,37 +57,46 @@ def plotter(DATA_OUT_FILE):
     x_dis = []
     y_dis = []
     for i in range(numDroplets):
-        x_dis.append(np.array(xVals[i]) - np.average(xVals[i]))
-        y_dis.append(np.array(yVals[i]) - np.average(yVals[i]))
+        x_dis.append(np.array(xVals[i]) - np.nanmean(xVals[i]))
+        y_dis.append(np.array(yVals[i]) - np.nanmean(yVals[i]))
 
     # Get v_x and v_y
-    v_x = [[0] for i in range(numDroplets)]
-    v_y = [[0] for i in range(numDroplets)]
-    for i in range(numDroplets):
-        for j in range(1, numRows):
-            v_x[i].append((xVals[i][j] - xVals[i][j - 1]) * FPS)
-            v_y[i].append((yVals[i][j] - yVals[i][j - 1]) * FPS)
+    if analysed:
+        v_x = [pd.read_parquet(DATA_OUT_FILE, columns=["vx_" + str(i)]).to_numpy().flatten() for i in range(numDroplets)]
+        v_y = [pd.read_parquet(DATA_OUT_FILE, columns=["vy_" + str(i)]).to_numpy().flatten() for i in range(numDroplets)]
+    else:
+        v_x = [[0] for i in range(numDroplets)]
+        v_y = [[0] for i in range(numDroplets)]
+        for i in range(numDroplets):
+            for j in range(1, numRows):
+                v_x[i].append((xVals[i][j] - xVals[i][j - 1]) * FPS)
+                v_y[i].append((yVals[i][j] - yVals[i][j - 1]) * FPS)
 
     # Get velocity displacement of droplet
     v2_dis = []
     for i in range(numDroplets):
         v = np.sqrt(np.power(v_x[i], 2) + np.power(v_y[i], 2))
-        vx_avg = np.average(v_x[i])
-        vy_avg = np.average(v_y[i])
+        vx_avg = np.nanmean(v_x[i])
+        vy_avg = np.nanmean(v_y[i])
         v_avg = np.sqrt(np.power(vx_avg, 2) + np.power(vy_avg, 2))
         v2_dis.append(np.power(v - v_avg, 2))
 
-    # Get a_x and a_y (microns / s^2)
-    a_x = [[0] for i in range(numDroplets)]
-    a_y = [[0] for i in range(numDroplets)]
-    for i in range(numDroplets):
-        for j in range(1, numRows):
-            a_x[i].append((v_x[i][j] - v_x[i][j - 1]) * FPS)
-            a_y[i].append((v_y[i][j] - v_y[i][j - 1]) * FPS)
-
-    # Convert a_x and a_y to m/s^2
-    a_x = np.array(a_x) * 1e-6
-    a_y = np.array(a_y) * 1e-6
+    if analysed:
+        # Get a_x and a_y (m/s^2)
+        a_x = np.array([pd.read_parquet(DATA_OUT_FILE, columns=["ax_" + str(i)]).to_numpy().flatten() for i in range(numDroplets)])
+        a_y = np.array([pd.read_parquet(DATA_OUT_FILE, columns=["ay_" + str(i)]).to_numpy().flatten() for i in range(numDroplets)])
+    else:
+        # Get a_x and a_y (microns / s^2)
+        a_x = [[0] for i in range(numDroplets)]
+        a_y = [[0] for i in range(numDroplets)]
+        for i in range(numDroplets):
+            for j in range(1, numRows):
+                a_x[i].append((v_x[i][j] - v_x[i][j - 1]) * FPS)
+                a_y[i].append((v_y[i][j] - v_y[i][j - 1]) * FPS)
+
+        # Convert a_x and a_y to m/s^2
+        a_x = np.array(a_x) * 1e-6
+        a_y = np.array(a_y) * 1e-6
 
     # Create a_x(t) and a_y(t) plots
     for i in range(numDroplets):